@@ -125,17 +125,26 @@ paddr_t ram_getfirstfree(void);
 /*
  * TLB shootdown bits.
  *
- * We'll take up to 16 invalidations before just flushing the whole TLB.
+ * A shootdown names the TLB entry to invalidate on the target CPU by
+ * the entryhi it was loaded with, which carries the address space ID
+ * the address space has on that CPU; or, with ts_all set, every entry
+ * with that address space ID. The ID is only meaningful in the ASID
+ * generation the target was in when the shootdown was sent. The
+ * sender waits for ts_wait to be acknowledged (see addrspace.c), so
+ * each CPU has at most one outstanding and TLBSHOOTDOWN_MAX bounds how
+ * many CPUs may shoot at one target at once.
  */
 
+struct tlbshootdown_wait;
+
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	uint32_t ts_entryhi;		/* page and ASID to invalidate */
+	bool ts_all;			/* every page with the ASID */
+	uint32_t ts_generation;		/* target's ASID generation */
+	struct tlbshootdown_wait *ts_wait;	/* acknowledged when done */
 };
 
-#define TLBSHOOTDOWN_MAX 16
+#define TLBSHOOTDOWN_MAX 32	/* at least MAXCPUS; see cpu.h */
 
 
 #endif /* _MIPS_VM_H_ */
@@ -157,6 +157,11 @@ mips_trap(struct trapframe *tf)
 						+ STACK_SIZE));
 	}
 
+	/* Remember where the user stack was, for vm_fault */
+	if (!iskern && curthread != NULL) {
+		curthread->t_usersp = tf->tf_sp;
+	}
+
 	/* Interrupt? Call the interrupt handler and return. */
 	if (code == EX_IRQ) {
 		int old_in;
@@ -37,6 +37,7 @@
 #include <current.h>
 #include <copyinout.h>
 #include <syscall.h>
+#include "opt-dumbvm.h"
 
 
 /*
@@ -120,6 +121,10 @@ syscall(struct trapframe *tf)
 		err = sys_fork(tf, &retval);
 		break;
 
+	    case SYS_vfork:
+		err = sys_vfork(tf, &retval);
+		break;
+
 	    case SYS_execv:
 		err = sys_execv(
 			(userptr_t)tf->tf_a0,
@@ -143,6 +148,54 @@ syscall(struct trapframe *tf)
 		break;
 
 
+#if !OPT_DUMBVM
+	    /* virtual memory calls */
+
+	    case SYS_sbrk:
+		{
+			vaddr_t oldbreak;
+
+			err = sys_sbrk((intptr_t)tf->tf_a0, &oldbreak);
+			retval = (int32_t)oldbreak;
+		}
+		break;
+
+	    case SYS_mmap:
+		{
+			/*
+			 * The 64-bit offset has to start in an even
+			 * argument slot, which is past a3, so it is on
+			 * the stack.
+			 */
+			off_t offset;
+			vaddr_t addr;
+
+			err = copyin((userptr_t)tf->tf_sp + 16,
+				     &offset, sizeof(offset));
+			if (err) {
+				break;
+			}
+
+			err = sys_mmap(tf->tf_a0, tf->tf_a1, tf->tf_a2,
+				       offset, &addr);
+			retval = (int32_t)addr;
+		}
+		break;
+
+	    case SYS_munmap:
+		err = sys_munmap(tf->tf_a0);
+		break;
+
+	    case SYS_msync:
+		err = sys_msync(tf->tf_a0);
+		break;
+
+	    case SYS_vmstat:
+		err = sys_vmstat((userptr_t)tf->tf_a0);
+		break;
+#endif
+
+
 	    /* file calls */
 
 	    case SYS_open:
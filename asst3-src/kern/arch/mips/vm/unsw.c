@@ -29,9 +29,13 @@
 
 #include <types.h>
 #include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
 #include <vm.h>
 #include <mainbus.h>
 #include <spinlock.h>
+#include <vmstats.h>
 
 vaddr_t firstfree;   /* first free virtual address; set by start.S */
 
@@ -41,24 +45,206 @@ static paddr_t lastpaddr;   /* one past end of last free physical page */
 typedef struct ft_entry {
         unsigned allocated:1; /* the corresponding frame is allocated */
         unsigned not_last:1; /* the frame is part of a multiframe allocation */
+        unsigned referenced:1; /* used since the clock hand last passed */
+        unsigned pinned:1; /* being filled or paged out; not a victim */
+        unsigned evicting:1; /* chosen by the pager and not freed since */
+        unsigned user:1; /* holds a user page (frame_set_owner) */
+        unsigned refcount:26; /* number of page table entries sharing the frame */
+        struct addrspace *owner; /* reverse mapping of a user page, */
+        vaddr_t vaddr;           /* or NULL if not known */
+        unsigned order:5;      /* log2 of the size of the block this frame heads */
+        unsigned free_head:1;  /* heads a free block on free_lists[order] */
+        uint32_t free_next;    /* free list links of a free block's head */
+        uint32_t free_prev;
 } ft_entry_t;
 
 
 static ft_entry_t * frame_table = NULL; /* base of frame table */
 static uint32_t first_frame;
 static uint32_t last_frame;
+static uint32_t clock_hand; /* next frame considered for paging out */
+
+/*
+ * Buddy allocator. Free frames are kept in naturally aligned blocks of
+ * 2^order frames, one doubly linked free list per order, threaded
+ * through the frame table entries of the blocks' first frames. Frame 0
+ * always belongs to the kernel, so 0 ends a list. Allocations need not
+ * be a power of two frames: the frames past the end of one go back on
+ * the free lists, and not_last marks where it ends.
+ */
+#define BUDDY_ORDERS 11 /* blocks of up to 2^10 frames (4MB) */
+#define FRAME_NONE 0
+
+static uint32_t free_lists[BUDDY_ORDERS];
+static uint32_t free_list_frames; /* frames in the blocks on free_lists */
 
 #define PAGE_BITS 12
 #define TRUE 1
 #define FALSE 0
 
 
-/* frame_table protected by spinlock (interrupt disabling on
+/* frame_table protected by spinlocks (interrupt disabling on
  * uniprocessor) as this implementation does not block.
+ *
+ * frame_table_spinlock protects the buddy free lists, along with the
+ * order, free_head and list links of the frames on them. The rest of
+ * each frame's entry is protected by one of FRAME_LOCKS striped locks
+ * chosen by frame number, so that sharing, reverse mappings and the
+ * pager's clock do not contend with allocation. A frame's allocated
+ * bit only changes with its stripe lock held. frame_table_spinlock
+ * is taken before any stripe lock.
+ *
+ * Single frames are also cached per cpu in front of the free lists
+ * (c_frames in struct cpu) and moved to and from them in batches, so
+ * most allocations and frees only take the frame's own stripe lock.
+ * Cached frames are free, but on no free list.
  */ 
 
 static struct spinlock frame_table_spinlock = SPINLOCK_INITIALIZER;
 
+#define FRAME_LOCKS 32
+#define FRAME_LOCK(i) (&frame_locks[(i) % FRAME_LOCKS])
+
+static struct spinlock frame_locks[FRAME_LOCKS];
+static struct spinlock clock_lock = SPINLOCK_INITIALIZER; /* clock_hand */
+
+/*
+ * Free lists of the buddy allocator. The caller holds
+ * frame_table_spinlock, except during ram_bootstrap().
+ */
+
+static void buddy_push(uint32_t i, uint32_t order)
+{
+        uint32_t head = free_lists[order];
+
+        frame_table[i].order = order;
+        frame_table[i].free_head = TRUE;
+        free_list_frames += 1 << order;
+        frame_table[i].free_prev = FRAME_NONE;
+        frame_table[i].free_next = head;
+        if (head != FRAME_NONE) {
+                frame_table[head].free_prev = i;
+        }
+        free_lists[order] = i;
+}
+
+static void buddy_remove(uint32_t i)
+{
+        uint32_t prev = frame_table[i].free_prev;
+        uint32_t next = frame_table[i].free_next;
+
+        KASSERT(frame_table[i].free_head == TRUE);
+
+        if (prev != FRAME_NONE) {
+                frame_table[prev].free_next = next;
+        }
+        else {
+                free_lists[frame_table[i].order] = next;
+        }
+        if (next != FRAME_NONE) {
+                frame_table[next].free_prev = prev;
+        }
+        frame_table[i].free_head = FALSE;
+        free_list_frames -= 1 << frame_table[i].order;
+}
+
+/*
+ * Take a free block of 2^order frames off the free lists: the smallest
+ * free block that is big enough, split in halves, putting the upper
+ * half back each time, until it is the right size. Returns the block's
+ * first frame, or FRAME_NONE.
+ */
+static uint32_t buddy_alloc(uint32_t order)
+{
+        uint32_t i, k;
+
+        for (k = order; k < BUDDY_ORDERS; k++) {
+                if (free_lists[k] != FRAME_NONE) {
+                        break;
+                }
+        }
+        if (k == BUDDY_ORDERS) {
+                return FRAME_NONE;
+        }
+
+        i = free_lists[k];
+        buddy_remove(i);
+        while (k > order) {
+                k--;
+                buddy_push(i + (1 << k), k);
+        }
+        frame_table[i].order = order;
+
+        return i;
+}
+
+/*
+ * Put a free block of 2^order frames back, merging it with its buddy
+ * for as long as the buddy is wholly free.
+ */
+static void buddy_free(uint32_t i, uint32_t order)
+{
+        uint32_t buddy;
+
+        KASSERT((i & ((1 << order) - 1)) == 0);
+
+        while (order < BUDDY_ORDERS - 1) {
+                buddy = i ^ (1 << order);
+                if (buddy < first_frame || buddy + (1 << order) > last_frame ||
+                    frame_table[buddy].free_head == FALSE ||
+                    frame_table[buddy].order != order) {
+                        break;
+                }
+                buddy_remove(buddy);
+                if (buddy < i) {
+                        i = buddy;
+                }
+                order++;
+        }
+        buddy_push(i, order);
+}
+
+/*
+ * Put the free frames [i, i + npages) back as the fewest naturally
+ * aligned blocks that cover them.
+ */
+static void buddy_free_range(uint32_t i, uint32_t npages)
+{
+        uint32_t end = i + npages;
+        uint32_t order;
+
+        while (i < end) {
+                order = 0;
+                while (order < BUDDY_ORDERS - 1 &&
+                       (i & (1 << order)) == 0 &&
+                       i + (2 << order) <= end) {
+                        order++;
+                }
+                buddy_free(i, order);
+                i += 1 << order;
+        }
+}
+
+/*
+ * Take npages contiguous frames off the free lists: a block of the next
+ * power of two up, with the frames past the first npages put straight
+ * back. Returns the first frame, or FRAME_NONE.
+ */
+static uint32_t buddy_alloc_pages(uint32_t npages)
+{
+        uint32_t i, order = 0;
+
+        while ((1U << order) < npages) {
+                order++;
+        }
+
+        i = buddy_alloc(order);
+        if (i != FRAME_NONE && npages < (1U << order)) {
+                buddy_free_range(i + npages, (1 << order) - npages);
+        }
+        return i;
+}
+
 /*
  * Called very early in system boot to figure out how much physical
  * RAM is available.
@@ -102,6 +288,10 @@ ram_bootstrap(void)
         KASSERT((firstpaddr & PAGE_FRAME) == firstpaddr);
 	KASSERT((lastpaddr & PAGE_FRAME) == lastpaddr);
 
+        for (i = 0; i < FRAME_LOCKS; i++) {
+                spinlock_init(&frame_locks[i]);
+        }
+
         npages = lastpaddr / PAGE_SIZE; /* number of pages in ram */
         last_frame = npages;
 
@@ -128,6 +318,14 @@ ram_bootstrap(void)
                 /* Mark as allocated as individual pages */
                 frame_table[i].allocated = TRUE;
                 frame_table[i].not_last = FALSE;
+                frame_table[i].referenced = FALSE;
+                frame_table[i].pinned = FALSE;
+                frame_table[i].evicting = FALSE;
+                frame_table[i].user = FALSE;
+                frame_table[i].refcount = 1;
+                frame_table[i].owner = NULL;
+                frame_table[i].order = 0;
+                frame_table[i].free_head = FALSE;
         }                                            
         
         /* 
@@ -138,6 +336,33 @@ ram_bootstrap(void)
         
         for (i = first_frame; i < (lastpaddr >> PAGE_BITS); i++) {
                 frame_table[i].allocated = FALSE;
+                frame_table[i].referenced = FALSE;
+                frame_table[i].pinned = FALSE;
+                frame_table[i].evicting = FALSE;
+                frame_table[i].user = FALSE;
+                frame_table[i].refcount = 0;
+                frame_table[i].owner = NULL;
+                frame_table[i].order = 0;
+                frame_table[i].free_head = FALSE;
+        }
+        clock_hand = first_frame;
+
+        /*
+         * Hand the free range to the buddy allocator in the largest
+         * aligned blocks that fit.
+         */
+        for (i = 0; i < BUDDY_ORDERS; i++) {
+                free_lists[i] = FRAME_NONE;
+        }
+        i = first_frame;
+        while (i < last_frame) {
+                uint32_t order = BUDDY_ORDERS - 1;
+                while ((i & ((1 << order) - 1)) != 0 ||
+                       i + (1 << order) > last_frame) {
+                        order--;
+                }
+                buddy_push(i, order);
+                i += 1 << order;
         }
 
         
@@ -187,89 +412,148 @@ ram_getfirstfree(void)
 }
 
 /*
- * This is a relatively inefficient first-fit allocator. Single pages
- * always fit. Multiframe allocations can suffer from external
- * fragmentation. It is intended to be easy to understand and robust,
- * not efficient.
+ * Mark the frames of a block just taken off the free lists or out of
+ * a per-cpu cache as allocated.
  */
 
-static paddr_t alloc_one_frame(unsigned int npages)
+static void claim_frames(uint32_t i, uint32_t npages)
 {
-        unsigned int i;
+        uint32_t j;
+
+        for (j = i; j < i + npages; j++) {
+                spinlock_acquire(FRAME_LOCK(j));
+                KASSERT(frame_table[j].allocated == FALSE);
+                frame_table[j].allocated = TRUE;    /* mark frame allocated */
+                frame_table[j].not_last = TRUE;     /* as a contiguous block */
+                frame_table[j].refcount = 1;
+                spinlock_release(FRAME_LOCK(j));
+        }
+        spinlock_acquire(FRAME_LOCK(j - 1));
+        frame_table[j - 1].not_last = FALSE;
+        spinlock_release(FRAME_LOCK(j - 1));
 
-        /* 
-         * Just scan from the start of the frame_table array for an
-         * unallocated block
-         */
-        
-        KASSERT(npages == 1);
+        VMSTAT_ADD(vs_framealloc, npages);
+}
 
-        spinlock_acquire(&frame_table_spinlock);
-        for (i =  first_frame; i < last_frame; i++) {
-                if (frame_table[i].allocated == FALSE) {
-                        frame_table[i].allocated = TRUE;
-                        frame_table[i].not_last = FALSE;
+/*
+ * Per-cpu frame caches. Each is used by its own cpu with interrupts
+ * off, so the current thread cannot be switched out (or moved to
+ * another cpu) while it uses one. Its lock is almost never contended:
+ * other cpus only take it to empty the cache when frames run out.
+ */
+
+/* Top up the cache with half a cache's worth of frames */
+static void frame_cache_refill(struct cpu *c)
+{
+        uint32_t i;
 
-                        spinlock_release(&frame_table_spinlock);
+        KASSERT(spinlock_do_i_hold(&c->c_frames_lock));
 
-                        return (paddr_t) (i << PAGE_BITS);
+        spinlock_acquire(&frame_table_spinlock);
+        while (c->c_numframes < CPU_FRAMES / 2) {
+                i = buddy_alloc(0);
+                if (i == FRAME_NONE) {
+                        break;
                 }
+                c->c_frames[c->c_numframes++] = i;
         }
-        
-        /* Did not find an unallocated frame :-( */
-
         spinlock_release(&frame_table_spinlock);
-        return (paddr_t) 0;
 }
 
-static paddr_t alloc_multiple_frames(unsigned int npages)
+/* Return NFRAMES frames from the cache to the free lists */
+static void frame_cache_drain(struct cpu *c, unsigned nframes)
 {
-        unsigned int i,j;
-
-
-        /* scan from 'i' for the number of needed free frames. If an
-         * allocated frame is encountered, restart the scan from after
-         * that point.
-         */
-        
+        KASSERT(spinlock_do_i_hold(&c->c_frames_lock));
+        KASSERT(nframes <= c->c_numframes);
 
         spinlock_acquire(&frame_table_spinlock);
+        while (nframes-- > 0) {
+                buddy_free(c->c_frames[--c->c_numframes], 0);
+        }
+        spinlock_release(&frame_table_spinlock);
+}
+
+/* Return every cpu's cached frames to the free lists */
+static void frame_cache_drain_all(void)
+{
+        struct cpu *c;
+        unsigned n;
 
-        i = first_frame; j = 0;
+        for (n = 0; (c = cpu_lookup(n)) != NULL; n++) {
+                spinlock_acquire(&c->c_frames_lock);
+                frame_cache_drain(c, c->c_numframes);
+                spinlock_release(&c->c_frames_lock);
+        }
+}
 
-        while (i < (last_frame - npages) && j < npages) {
-                if (frame_table[i+j].allocated == TRUE) {
-                        i = i + j + 1; /* continue scan after allocated frame */
-                        j = 0;         /* restart the count */
-                }
-                else {
-                        j = j + 1; /* increment count of free frames */
+static paddr_t alloc_frames(uint32_t npages)
+{
+        struct cpu *c;
+        uint32_t i;
+        int spl;
+
+        if (npages == 1 && CURCPU_EXISTS()) {
+                spl = splhigh();
+                c = curcpu->c_self;
+                spinlock_acquire(&c->c_frames_lock);
+                if (c->c_numframes == 0) {
+                        frame_cache_refill(c);
                 }
+                i = c->c_numframes > 0 ?
+                        c->c_frames[--c->c_numframes] : FRAME_NONE;
+                spinlock_release(&c->c_frames_lock);
+                splx(spl);
+        }
+        else {
+                spinlock_acquire(&frame_table_spinlock);
+                i = buddy_alloc_pages(npages);
+                spinlock_release(&frame_table_spinlock);
         }
 
-        if  (j == npages) { /* we exited as we found the number of frames required. */
-                for (j = i; j < i + npages - 1; j++) {
-                        frame_table[j].allocated = TRUE; /* mark frame allocated */
-                        frame_table[j].not_last = TRUE;  /* as a contiguous block */
-                }
-                frame_table[j].allocated = TRUE;
-                frame_table[j].not_last = FALSE;
+        if (i == FRAME_NONE && CURCPU_EXISTS()) {
+                /*
+                 * The frames cached by the cpus may be all that is
+                 * left, or what stops a block from being whole; give
+                 * them all back and try again.
+                 */
+                frame_cache_drain_all();
 
+                spinlock_acquire(&frame_table_spinlock);
+                i = buddy_alloc_pages(npages);
                 spinlock_release(&frame_table_spinlock);
-                
-                return (paddr_t) (i << PAGE_BITS);
         }
-        
-        /* Did not find an unallocated contiguous range of frames :-( */
 
-        spinlock_release(&frame_table_spinlock);
-        return (paddr_t) 0;
+        if (i == FRAME_NONE) {
+                /* Did not find a large enough block :-( */
+                return (paddr_t) 0;
+        }
+
+        claim_frames(i, npages);
+        return (paddr_t) (i << PAGE_BITS);
+}
+
+/* Mark a frame of a block being freed as free; the caller holds its lock */
+static void release_frame(uint32_t i)
+{
+        KASSERT(frame_table[i].allocated == TRUE);
+
+        frame_table[i].allocated = FALSE;
+        frame_table[i].not_last = FALSE;
+        frame_table[i].referenced = FALSE;
+        frame_table[i].pinned = FALSE;
+        frame_table[i].evicting = FALSE;
+        frame_table[i].user = FALSE;
+        frame_table[i].refcount = 0;
+        frame_table[i].owner = NULL;
 }
 
 static void free_frames(vaddr_t vaddr)
 {
+        struct cpu *c;
         paddr_t paddr;
-        uint32_t i;
+        uint32_t i, j, npages;
+        bool last;
+        int spl;
 
         KASSERT(vaddr != (vaddr_t) NULL);
 
@@ -277,18 +561,52 @@ static void free_frames(vaddr_t vaddr)
 
         i = paddr >> PAGE_BITS;
 
-        spinlock_acquire(&frame_table_spinlock);
+        spinlock_acquire(FRAME_LOCK(i));
 
         if (frame_table[i].allocated == FALSE) { /* check for double free error */
                 panic("Double free error!!");
         }
-        
-        while (frame_table[i].allocated == TRUE) { /* otherwise mark block free */
-                frame_table[i].allocated = FALSE;
-                if (frame_table[i].not_last == TRUE) {
-                        i++;
+
+        /*
+         * A frame shared copy-on-write is only released once the
+         * last page table entry referring to it lets go.
+         */
+        if (frame_table[i].refcount > 1) {
+                KASSERT(frame_table[i].not_last == FALSE);
+                frame_table[i].refcount--;
+                spinlock_release(FRAME_LOCK(i));
+                return;
+        }
+
+        last = frame_table[i].not_last == FALSE;
+        release_frame(i);                     /* otherwise mark block free */
+        spinlock_release(FRAME_LOCK(i));
+
+        /* the rest of the block runs up to the frame without not_last */
+        for (j = i + 1; !last; j++) {
+                spinlock_acquire(FRAME_LOCK(j));
+                last = frame_table[j].not_last == FALSE;
+                release_frame(j);
+                spinlock_release(FRAME_LOCK(j));
+        }
+        npages = j - i;
+        VMSTAT_ADD(vs_framefree, npages);
+
+        if (npages == 1 && CURCPU_EXISTS()) {
+                spl = splhigh();
+                c = curcpu->c_self;
+                spinlock_acquire(&c->c_frames_lock);
+                if (c->c_numframes == CPU_FRAMES) {
+                        frame_cache_drain(c, CPU_FRAMES / 2);
                 }
+                c->c_frames[c->c_numframes++] = i;
+                spinlock_release(&c->c_frames_lock);
+                splx(spl);
+                return;
         }
+
+        spinlock_acquire(&frame_table_spinlock);
+        buddy_free_range(i, npages);
         spinlock_release(&frame_table_spinlock);
 }
         
@@ -297,12 +615,15 @@ vaddr_t
 alloc_kpages(unsigned npages)
 {
         paddr_t paddr;
-        if (npages > 1 ) {
-                paddr = alloc_multiple_frames(npages);
-        }
-        else {
-                paddr = alloc_one_frame(npages);
+
+        KASSERT(npages > 0);
+
+        /* no larger than the largest block the free lists hold */
+        if (npages > (1U << (BUDDY_ORDERS - 1))) {
+                return 0;
         }
+
+        paddr = alloc_frames(npages);
         
 	if (paddr == 0) {
 		return 0;
@@ -315,3 +636,306 @@ free_kpages(vaddr_t addr)
 {
         free_frames(addr);
 }
+
+/*
+ * Count the frames the allocator manages, and those of them that are
+ * free, cached per cpu or not. The frame table is read without its
+ * locks, so the count may be a frame or two out while others allocate.
+ */
+void
+frame_usage(struct vmstats *vs)
+{
+        uint32_t i, nfree = 0;
+
+        for (i = first_frame; i < last_frame; i++) {
+                if (frame_table[i].allocated == FALSE) {
+                        nfree++;
+                }
+        }
+        vs->vs_frames = last_frame - first_frame;
+        vs->vs_framesfree = nfree;
+}
+
+/*
+ * Count the free frames, on the free lists or cached per cpu, without
+ * scanning the frame table. Read without locks, so only a guide.
+ */
+unsigned
+frame_free_count(void)
+{
+        struct cpu *c;
+        unsigned n, nfree = free_list_frames;
+
+        for (n = 0; (c = cpu_lookup(n)) != NULL; n++) {
+                nfree += c->c_numframes;
+        }
+        return nfree;
+}
+
+/*
+ * Take an extra reference to a single allocated frame so that it can
+ * be mapped by more than one page table entry. Each reference is
+ * dropped again with free_kpages(). Sharing a frame the pager has
+ * chosen calls the eviction off (see frame_evictable()).
+ */
+void
+ref_kpage(vaddr_t addr)
+{
+        uint32_t i;
+
+        KASSERT(addr != (vaddr_t) NULL);
+        i = KVADDR_TO_PADDR(addr) >> PAGE_BITS;
+
+        spinlock_acquire(FRAME_LOCK(i));
+        KASSERT(frame_table[i].allocated == TRUE);
+        KASSERT(frame_table[i].not_last == FALSE);
+        frame_table[i].refcount++;
+        if (frame_table[i].evicting == TRUE) {
+                frame_table[i].evicting = FALSE;
+                frame_table[i].pinned = FALSE;
+        }
+        spinlock_release(FRAME_LOCK(i));
+}
+
+/* Number of page table entries currently sharing the frame */
+unsigned
+kpage_refcount(vaddr_t addr)
+{
+        unsigned refcount;
+        uint32_t i;
+
+        KASSERT(addr != (vaddr_t) NULL);
+        i = KVADDR_TO_PADDR(addr) >> PAGE_BITS;
+
+        spinlock_acquire(FRAME_LOCK(i));
+        KASSERT(frame_table[i].allocated == TRUE);
+        refcount = frame_table[i].refcount;
+        spinlock_release(FRAME_LOCK(i));
+
+        return refcount;
+}
+
+/*
+ * Paging support: reverse mappings and second-chance victim selection.
+ *
+ * Frames holding user pages record the (address space, vaddr) that
+ * maps them, so the pager can find the page table entry to update when
+ * it steals the frame. Only frames with a single mapping are ever
+ * chosen; frames shared copy-on-write stay resident.
+ */
+
+/*
+ * Record that the user page VADDR of AS lives in the frame at kernel
+ * address ADDR. The frame is pinned until its owner calls
+ * frame_unpin(), so it cannot be paged out while it is being filled.
+ */
+void
+frame_set_owner(vaddr_t addr, struct addrspace *as, vaddr_t vaddr)
+{
+        uint32_t i;
+
+        KASSERT(addr != (vaddr_t) NULL);
+        i = KVADDR_TO_PADDR(addr) >> PAGE_BITS;
+
+        spinlock_acquire(FRAME_LOCK(i));
+        KASSERT(frame_table[i].allocated == TRUE);
+        KASSERT(frame_table[i].not_last == FALSE);
+        frame_table[i].user = TRUE;
+        frame_table[i].owner = as;
+        frame_table[i].vaddr = vaddr;
+        frame_table[i].referenced = TRUE;
+        frame_table[i].pinned = TRUE;
+        spinlock_release(FRAME_LOCK(i));
+}
+
+/*
+ * AS no longer maps the frame at ADDR, which other address spaces
+ * still share. If AS was the recorded owner, forget it, so the pager
+ * never follows the reverse mapping to an address space that may be
+ * gone; it has to search the page table for the frame instead.
+ */
+void
+frame_clear_owner(vaddr_t addr, struct addrspace *as)
+{
+        uint32_t i;
+
+        KASSERT(addr != (vaddr_t) NULL);
+        i = KVADDR_TO_PADDR(addr) >> PAGE_BITS;
+
+        spinlock_acquire(FRAME_LOCK(i));
+        if (frame_table[i].owner == as) {
+                frame_table[i].owner = NULL;
+                frame_table[i].vaddr = 0;
+        }
+        spinlock_release(FRAME_LOCK(i));
+}
+
+/*
+ * Take the frame at ADDR out of the pager's hands until
+ * frame_allow_paging(): it is shared through the text cache, which
+ * pages of executables are read back into rather than from swap (see
+ * textcache.c).
+ */
+void
+frame_keep_resident(vaddr_t addr)
+{
+        uint32_t i;
+
+        KASSERT(addr != (vaddr_t) NULL);
+        i = KVADDR_TO_PADDR(addr) >> PAGE_BITS;
+
+        spinlock_acquire(FRAME_LOCK(i));
+        KASSERT(frame_table[i].allocated == TRUE);
+        frame_table[i].user = FALSE;
+        frame_table[i].owner = NULL;
+        frame_table[i].vaddr = 0;
+        spinlock_release(FRAME_LOCK(i));
+}
+
+/*
+ * Undo frame_keep_resident() once the text cache lets go of the frame
+ * at ADDR. Processes may still be mapping it; with no owner recorded,
+ * the pager looks them up if the frame is ever chosen.
+ */
+void
+frame_allow_paging(vaddr_t addr)
+{
+        uint32_t i;
+
+        KASSERT(addr != (vaddr_t) NULL);
+        i = KVADDR_TO_PADDR(addr) >> PAGE_BITS;
+
+        spinlock_acquire(FRAME_LOCK(i));
+        KASSERT(frame_table[i].allocated == TRUE);
+        frame_table[i].user = TRUE;
+        spinlock_release(FRAME_LOCK(i));
+}
+
+/* Make a user frame a candidate for paging out again */
+void
+frame_unpin(vaddr_t addr)
+{
+        uint32_t i;
+
+        KASSERT(addr != (vaddr_t) NULL);
+        i = KVADDR_TO_PADDR(addr) >> PAGE_BITS;
+
+        spinlock_acquire(FRAME_LOCK(i));
+        KASSERT(frame_table[i].allocated == TRUE);
+        frame_table[i].pinned = FALSE;
+        spinlock_release(FRAME_LOCK(i));
+}
+
+/* Note a use of the frame (a TLB refill) for the clock algorithm */
+void
+frame_touch(vaddr_t addr)
+{
+        uint32_t i;
+
+        KASSERT(addr != (vaddr_t) NULL);
+        i = KVADDR_TO_PADDR(addr) >> PAGE_BITS;
+
+        spinlock_acquire(FRAME_LOCK(i));
+        frame_table[i].referenced = TRUE;
+        spinlock_release(FRAME_LOCK(i));
+}
+
+/*
+ * Pick a user frame to page out with the clock (second chance)
+ * algorithm: sweep the frame table, clearing the referenced bit of
+ * recently used frames and taking the first unpinned, unshared frame
+ * found without it. The victim is returned pinned and marked for
+ * eviction, along with its reverse mapping in AS and VADDR (AS is NULL
+ * if it is not known; see frame_clear_owner()). Returns 0 if there is
+ * nothing that could be paged out.
+ */
+vaddr_t
+frame_choose_victim(struct addrspace **as, vaddr_t *vaddr)
+{
+        uint32_t i, n;
+
+        spinlock_acquire(&clock_lock);
+
+        /* two sweeps: the first may only clear referenced bits */
+        for (n = 0; n < 2 * (last_frame - first_frame); n++) {
+                i = clock_hand;
+                clock_hand = (clock_hand + 1 < last_frame) ?
+                        clock_hand + 1 : first_frame;
+
+                spinlock_acquire(FRAME_LOCK(i));
+                if (frame_table[i].allocated == FALSE ||
+                    frame_table[i].user == FALSE ||
+                    frame_table[i].pinned == TRUE ||
+                    frame_table[i].refcount != 1) {
+                        spinlock_release(FRAME_LOCK(i));
+                        continue;
+                }
+                if (frame_table[i].referenced == TRUE) {
+                        frame_table[i].referenced = FALSE;
+                        spinlock_release(FRAME_LOCK(i));
+                        continue;
+                }
+
+                frame_table[i].pinned = TRUE;
+                frame_table[i].evicting = TRUE;
+                *as = frame_table[i].owner;
+                *vaddr = frame_table[i].vaddr;
+                spinlock_release(FRAME_LOCK(i));
+
+                spinlock_release(&clock_lock);
+                return PADDR_TO_KVADDR((paddr_t) (i << PAGE_BITS));
+        }
+
+        spinlock_release(&clock_lock);
+        return 0;
+}
+
+/*
+ * Check that the victim at ADDR may still be paged out: it has been
+ * neither freed nor shared copy-on-write since frame_choose_victim()
+ * returned it. While that holds, the reverse mapping the pager was
+ * given still names the one address space mapping the frame; the
+ * frame's owner field cannot be checked instead, since the frame may
+ * have been freed and reallocated to the same owner meanwhile. Called
+ * with the lock of the page table entry that maps the frame held, so
+ * the answer stays true until the entry has been unmapped.
+ */
+bool
+frame_evictable(vaddr_t addr)
+{
+        bool evictable;
+        uint32_t i;
+
+        KASSERT(addr != (vaddr_t) NULL);
+        i = KVADDR_TO_PADDR(addr) >> PAGE_BITS;
+
+        spinlock_acquire(FRAME_LOCK(i));
+        evictable = frame_table[i].allocated == TRUE &&
+                frame_table[i].evicting == TRUE &&
+                frame_table[i].refcount == 1;
+        spinlock_release(FRAME_LOCK(i));
+
+        return evictable;
+}
+
+/*
+ * Give up on paging out the victim at ADDR. The frame is only unpinned
+ * if it is still the victim; if it was freed it may already belong to
+ * someone else, who is relying on the pin.
+ */
+void
+frame_release_victim(vaddr_t addr)
+{
+        uint32_t i;
+
+        KASSERT(addr != (vaddr_t) NULL);
+        i = KVADDR_TO_PADDR(addr) >> PAGE_BITS;
+
+        spinlock_acquire(FRAME_LOCK(i));
+        if (frame_table[i].allocated == TRUE &&
+            frame_table[i].evicting == TRUE) {
+                frame_table[i].pinned = FALSE;
+                frame_table[i].evicting = FALSE;
+        }
+        spinlock_release(FRAME_LOCK(i));
+}
@@ -37,8 +37,16 @@
 #include <lib.h>
 #include <vfs.h>
 #include <sfs.h>
+#include <kmemcache.h>
 #include "sfsprivate.h"
 
+/*
+ * Cache of sfs_vnode structures, shared by every SFS volume. Created
+ * when the first vnode is loaded, under the big lock.
+ */
+#define SFS_VNODE_CACHE_MAX 32
+
+static struct kmem_cache *sfs_vnode_cache;
 
 /*
  * Write an on-disk inode structure back out to disk.
@@ -136,7 +144,7 @@ sfs_reclaim(struct vnode *v)
 	vfs_biglock_release();
 
 	/* Release the storage for the vnode structure itself. */
-	kfree(sv);
+	kmem_cache_free(sfs_vnode_cache, sv);
 
 	/* Done */
 	return 0;
@@ -184,7 +192,18 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 
 	/* Didn't have it loaded; load it */
 
-	sv = kmalloc(sizeof(struct sfs_vnode));
+	if (sfs_vnode_cache == NULL) {
+		KASSERT(vfs_biglock_do_i_hold());
+		sfs_vnode_cache = kmem_cache_create("sfs_vnode",
+						    sizeof(struct sfs_vnode),
+						    SFS_VNODE_CACHE_MAX,
+						    NULL, NULL);
+		if (sfs_vnode_cache == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	sv = kmem_cache_alloc(sfs_vnode_cache);
 	if (sv==NULL) {
 		return ENOMEM;
 	}
@@ -198,7 +217,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Read the block the inode is in */
 	result = sfs_readblock(sfs, ino, &sv->sv_i, sizeof(sv->sv_i));
 	if (result) {
-		kfree(sv);
+		kmem_cache_free(sfs_vnode_cache, sv);
 		return result;
 	}
 
@@ -235,7 +254,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = vnode_init(&sv->sv_absvn, ops, &sfs->sfs_absfs, sv);
 	if (result) {
-		kfree(sv);
+		kmem_cache_free(sfs_vnode_cache, sv);
 		return result;
 	}
 
@@ -246,7 +265,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_absvn, NULL);
 	if (result) {
 		vnode_cleanup(&sv->sv_absvn);
-		kfree(sv);
+		kmem_cache_free(sfs_vnode_cache, sv);
 		return result;
 	}
 
@@ -35,7 +35,10 @@
  */
 
 
+#include <array.h>
+#include <spinlock.h>
 #include <vm.h>
+#include <platform/maxcpus.h>
 #include "opt-dumbvm.h"
 
 struct vnode;
@@ -52,18 +55,41 @@ struct vnode;
 #define WRITE 0x2               // Write permission
 #define EXECUTE 0x4             // Execute permission
 
+// Region types. Regions made by mmap can be unmapped again, and shared
+// ones carry changes to their pages back to the file.
+#define REGION_SEGMENT 0        // program segment, heap or stack
+#define REGION_PRIVATE 1        // private mapping; changes stay in memory
+#define REGION_SHARED 2         // shared mapping; changes go to the file
+
 struct as_regions {
         vaddr_t base;
         size_t size;
 
-        // indicates if readonly region temporarily changed to 
-        // read_write for as_prepare_load()
-        bool read_only_change;  
-
         int permissions;
-        struct as_regions* next; // pointer to next region in list
+        int type;               // REGION_*
+
+        // file backing for demand-paged ELF segments; pages overlapping
+        // [file_vaddr, file_vaddr + file_size) are read from the vnode at
+        // file_offset on first touch, everything else is zero-filled
+        struct vnode *vnode;    // NULL for anonymous regions
+        off_t file_offset;
+        vaddr_t file_vaddr;
+        size_t file_size;
+
+        // frames of a shared mapping that was copied into a child, shared
+        // with every copy of it (see hpt_share())
+        struct region_share *share;
 };
 
+#if !OPT_DUMBVM
+#ifndef ASINLINE
+#define ASINLINE INLINE
+#endif
+
+DECLARRAY_BYTYPE(regionarray, struct as_regions, ASINLINE);
+DEFARRAY_BYTYPE(regionarray, struct as_regions, ASINLINE);
+#endif
+
 struct addrspace {
 #if OPT_DUMBVM
         vaddr_t as_vbase1;
@@ -75,19 +101,59 @@ struct addrspace {
         paddr_t as_stackpbase;
 #else
         /* Put stuff here for your VM system */
-        struct as_regions *regions; // points to first region in list
+        // regions sorted by base address; they never overlap, so a lookup
+        // is a binary search
+        struct regionarray regions;
+        struct as_regions *last_region; // last region found; usually hit again
+
+        // heap region after the program's segments, grown by sbrk; the
+        // region covers the break rounded up to a whole page
+        struct as_regions *heap;        // NULL until as_complete_load
+        vaddr_t heap_break;
+
+        // stack region; it starts VM_STACKPAGES long and grows down on
+        // demand, so mappings are kept below USERSTACK - VM_STACKMAX
+        struct as_regions *stack;       // NULL until as_define_stack
+
+        // pages with page table entries, so only they are visited when the
+        // address space is copied or destroyed (see hpt_pages_reserve())
+        vaddr_t **pages;                // chunks of at most a page
+        unsigned npages;
+        unsigned maxpages;
+        unsigned maxchunks;             // room in pages[]
+
+        // the page table backend's per-address-space state (see pagetable.h)
+        void *pt_data;
+
+        // MIPS address space IDs tagging this address space's TLB entries.
+        // Each CPU hands out its own IDs, so there is one for every CPU it
+        // has run on; asid[n] is only valid while asid_generation[n]
+        // matches CPU n's current generation. cpus has a bit for each CPU
+        // whose TLB may hold entries for it. All under tlb_lock.
+        struct spinlock tlb_lock;
+        uint32_t asid[MAXCPUS];
+        uint32_t asid_generation[MAXCPUS];
+        uint32_t cpus;
 #endif
 };
 
-void hpt_init(void);
-uint32_t hpt_hash(struct addrspace *as, vaddr_t address);
+struct pte;
+
+void hpt_lock(struct addrspace *as, vaddr_t vaddr);
+void hpt_unlock(struct addrspace *as, vaddr_t vaddr);
 void zero_pad(paddr_t paddr, unsigned npages);
-int hpt_add(struct addrspace *as, vaddr_t vaddr, int writeable, bool write_to_tlb);
-struct hpt_entry *hpt_get(struct addrspace *as, vaddr_t vaddr, struct hpt_entry **prev_entry);
+int hpt_add(struct addrspace *as, vaddr_t vaddr, int permissions, vaddr_t *frame);
+struct pte *hpt_get(struct addrspace *as, vaddr_t vaddr);
+int hpt_share(struct as_regions *region, struct as_regions *copy);
+void hpt_unshare(struct as_regions *region);
 int hpt_copy(struct as_regions *region, struct addrspace *old, struct addrspace *newas);
-void set_page_write_permissions(struct addrspace *as, vaddr_t vaddr, uint32_t memsize);
-void reset_page_write_permissions(struct addrspace *as, vaddr_t vaddr, uint32_t memsize);
+int hpt_cow_break(struct addrspace *as, vaddr_t vaddr);
+int hpt_swapin(struct addrspace *as, vaddr_t vaddr);
+bool hpt_pageout(struct addrspace *as, vaddr_t vaddr, vaddr_t kvaddr, uint32_t slot);
 void hpt_free(struct addrspace *as, vaddr_t vaddr, uint32_t memsize);
+void hpt_pages_destroy(struct addrspace *as, bool keep_first);
+int hpt_writeback(struct addrspace *as, struct as_regions *region);
+void hpt_printstats(void);
 
 /*
  * Functions in addrspace.c:
@@ -113,37 +179,94 @@ void hpt_free(struct addrspace *as, vaddr_t vaddr, uint32_t memsize);
  *    as_destroy - dispose of an address space. You may need to change
  *                the way this works if implementing user-level threads.
  *
+ *    as_tlb_entryhi - the TLB entryhi for VADDR in the address space,
+ *                tagged with its address space ID.
+ *
+ *    as_tlb_invalidate - remove the address space's TLB entries (if
+ *                any) for the page VADDR, on every CPU. Waits for other
+ *                CPUs running the address space to do so, and must then
+ *                be called without spinlocks held.
+ *
+ *    as_tlb_flush - remove all of the address space's TLB entries, on
+ *                every CPU, with the same proviso.
+ *
+ *    as_tlbshootdown - carry out a shootdown sent by another CPU's
+ *                as_tlb_invalidate or as_tlb_flush.
+ *
  *    as_define_region - set up a region of memory within the address
  *                space.
  *
+ *    as_find_region - return the region containing an address, or
+ *                NULL if there is none.
+ *
+ *    as_grow_stack - extend the stack region down to an address that
+ *                faulted just below it, if the stack may grow that
+ *                far and the address is near the given user stack
+ *                pointer. Returns the stack region, or NULL.
+ *
+ *    as_define_backing - attach the part of an executable that backs
+ *                a region defined with as_define_region. Pages are
+ *                read in from the file on first touch.
+ *
  *    as_prepare_load - this is called before actually loading from an
  *                executable into the address space.
  *
  *    as_complete_load - this is called when loading from an executable
  *                is complete.
  *
+ *    as_sbrk - move the end of the heap region, which starts just
+ *                after the program's segments, by an amount in bytes.
+ *                Hands back the old end.
+ *
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_mmap   - map part of a file, or anonymous memory, into a new
+ *                region placed by the kernel. Pages are read from the
+ *                file on first touch. Hands back the address of the
+ *                region.
+ *
+ *    as_munmap - remove a region made by as_mmap, writing changes to
+ *                a shared mapping back to the file first.
+ *
+ *    as_msync  - write changes to a shared mapping back to the file.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
 
+void              as_bootstrap(void);
 struct addrspace *as_create(void);
 int               as_copy(struct addrspace *src, struct addrspace **ret);
 void              as_activate(void);
 void              as_deactivate(void);
 void              as_destroy(struct addrspace *);
+uint32_t          as_tlb_entryhi(struct addrspace *as, vaddr_t vaddr);
+void              as_tlb_invalidate(struct addrspace *as, vaddr_t vaddr);
+void              as_tlb_flush(struct addrspace *as);
+void              as_tlbshootdown(const struct tlbshootdown *ts);
 
 int               as_define_region(struct addrspace *as,
                                    vaddr_t vaddr, size_t sz,
                                    int readable,
                                    int writeable,
                                    int executable);
+struct as_regions *as_find_region(struct addrspace *as, vaddr_t vaddr);
+struct as_regions *as_grow_stack(struct addrspace *as, vaddr_t vaddr,
+                                 vaddr_t sp);
+int               as_define_backing(struct addrspace *as, vaddr_t vaddr,
+                                    struct vnode *v, off_t offset,
+                                    size_t filesize);
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak);
+int               as_mmap(struct addrspace *as, size_t length,
+                          int permissions, int type, struct vnode *v,
+                          off_t offset, vaddr_t *addr);
+int               as_munmap(struct addrspace *as, vaddr_t addr);
+int               as_msync(struct addrspace *as, vaddr_t addr);
 
 
 /*
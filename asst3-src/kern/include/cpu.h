@@ -34,7 +34,19 @@
 #include <spinlock.h>
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
+#include <platform/maxcpus.h>
 
+/*
+ * Every other CPU may have a shootdown outstanding at this one at once
+ * (see ipi_tlbshootdown()), so the queue must have room for them all.
+ */
+#if TLBSHOOTDOWN_MAX < MAXCPUS
+#error "TLBSHOOTDOWN_MAX is smaller than MAXCPUS"
+#endif
+
+#define CPU_FRAMES 16	/* size of the per-cpu cache of free frames */
+#define CPU_KMALLOC_SIZES 8	/* kmalloc block sizes cached per cpu */
+#define CPU_THREADS 8		/* exited threads kept per cpu for reuse */
 
 /*
  * Per-cpu structure
@@ -62,6 +74,34 @@ struct cpu {
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
 
+	/*
+	 * Accessed by this cpu, with interrupts off, and by others
+	 * draining it when frames run out. Protected by c_frames_lock.
+	 * Free frames cached in front of the frame allocator; see
+	 * arch/mips/vm/unsw.c.
+	 */
+	uint32_t c_frames[CPU_FRAMES];	/* Frame numbers */
+	unsigned c_numframes;
+	struct spinlock c_frames_lock;
+
+	/*
+	 * Accessed by this cpu, with interrupts off, and by others
+	 * draining it when memory runs out. Protected by c_kmalloc_lock.
+	 * Free kmalloc blocks, one list per size; see vm/kmalloc.c.
+	 */
+	void *c_kmalloc_blocks[CPU_KMALLOC_SIZES];
+	unsigned c_kmalloc_nblocks[CPU_KMALLOC_SIZES];
+	struct spinlock c_kmalloc_lock;
+
+	/*
+	 * Accessed only by this cpu, with interrupts off.
+	 * Exited threads kept, stack and all, for thread_fork to
+	 * reuse; see thread/thread.c.
+	 */
+	struct threadlist c_threadpool;
+	unsigned c_threadpool_hits;	/* thread_forks served from the pool */
+	unsigned c_threadpool_misses;	/* thread_forks that had to allocate */
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
@@ -112,6 +152,13 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * Return the cpu whose software number (c_number) is NUMBER, or NULL
+ * if there is none. Cpus are numbered from 0 up, so this can be used
+ * to visit each of them.
+ */
+struct cpu *cpu_lookup(unsigned number);
+
 /*
  * Produce a string describing the CPU type.
  */
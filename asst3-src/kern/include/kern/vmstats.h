@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _KERN_VMSTATS_H_
+#define _KERN_VMSTATS_H_
+
+/*
+ * VM event counters, as returned by the vmstat() system call. They
+ * count from boot and never go back, so a program measures a run by
+ * reading them before and after.
+ */
+struct vmstats {
+	/* Faults (vm_fault) */
+	__u32 vs_faults;		/* all TLB faults */
+	__u32 vs_refills;		/* TLB refills of a mapped page */
+	__u32 vs_firsttouch;		/* first touches of a page */
+	__u32 vs_faultaround;	/* TLB entries preloaded by fault-around */
+
+	/* New pages */
+	__u32 vs_zerofills;		/* pages zero-filled */
+	__u32 vs_zeropool;		/* of those, already zeroed in the pool */
+
+	/* Fork */
+	__u32 vs_forkshared;		/* pages shared copy-on-write at fork */
+	__u32 vs_cowcopies;		/* of those, copied on a later write */
+
+	/* Paging */
+	__u32 vs_swapins;		/* pages read back from swap */
+	__u32 vs_swapouts;		/* pages written out to swap */
+
+	/* TLB */
+	__u32 vs_tlbflushes;		/* whole address spaces flushed */
+	__u32 vs_shootdowns;		/* shootdowns sent to other CPUs */
+
+	/* Page table */
+	__u32 vs_ptlookups;		/* lookups */
+	__u32 vs_ptprobes;		/* entries or levels visited by them */
+
+	/* Frame allocator */
+	__u32 vs_framealloc;		/* frames allocated */
+	__u32 vs_framefree;		/* frames freed */
+	__u32 vs_frames;		/* frames in physical memory, now */
+	__u32 vs_framesfree;		/* of those, free now */
+};
+
+
+#endif /* _KERN_VMSTATS_H_ */
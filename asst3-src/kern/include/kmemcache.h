@@ -0,0 +1,33 @@
+#ifndef _KMEMCACHE_H_
+#define _KMEMCACHE_H_
+
+/*
+ * Object caches.
+ *
+ * A cache hands out objects of one type that are already constructed:
+ * whatever the constructor sets up (locks, wait channels, arrays) is
+ * kept when an object is freed to the cache, and reused by the next
+ * allocation. An object must therefore be freed in the state the
+ * constructor leaves it in. Up to a cache's limit of free objects are
+ * kept; beyond that they are destructed and kfree'd.
+ *
+ * The constructor returns 0, or an error code if it cannot set the
+ * object up, in which case the allocation fails. Either may be NULL.
+ */
+
+struct kmem_cache; /* Opaque */
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     unsigned maxfree,
+				     int (*ctor)(void *obj),
+				     void (*dtor)(void *obj));
+void kmem_cache_destroy(struct kmem_cache *kc);
+
+/* Returns NULL if out of memory */
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+
+/* Print every cache's size and hit counts */
+void kmem_cache_printstats(void);
+
+#endif /* _KMEMCACHE_H_ */
@@ -59,6 +59,9 @@ struct openfile {
 	int of_refcount;
 };
 
+/* call once during system startup */
+void openfile_bootstrap(void);
+
 /* open a file (args must be kernel pointers; destroys filename) */
 int openfile_open(char *filename, int openflags, mode_t mode,
 		  struct openfile **ret);
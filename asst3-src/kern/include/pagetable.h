@@ -0,0 +1,102 @@
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+/*
+ * Page table backends.
+ *
+ * The VM system (vm.c) keeps one page table entry for each page of an
+ * address space that has a frame or a swap slot. How the entries are
+ * stored and found is up to a backend, chosen when the kernel is
+ * configured:
+ *
+ *    hashed   - one global hash table with open addressing and chains
+ *               (the default; pt_hashed.c)
+ *    twolevel - a two-level table per address space
+ *               (options twolevelpt; pt_twolevel.c)
+ *    inverted - one global table sized by physical memory, with a
+ *               hash anchor table in front of it
+ *               (options invertedpt; pt_inverted.c)
+ *
+ * vm.c uses the backend only through the hpt_lock(), hpt_unlock() and
+ * hpt_get() functions and the operations below.
+ */
+
+struct addrspace;
+
+/* A page table entry, whatever the backend */
+struct pte {
+        uint32_t entrylo;
+        uint32_t swapped:1;     // paged out to swap_slot; entrylo keeps only DIRTY
+        uint32_t swap_slot:31;
+};
+
+// an entry is in use if it maps a frame or a page in swap
+#define PTE_INUSE(pte) (((pte)->entrylo & TLBLO_VALID) || (pte)->swapped)
+
+/*
+ * Backend operations:
+ *
+ *    pt_bootstrap - set up global state; called once from vm_bootstrap
+ *                   after the swap device is attached.
+ *
+ *    pt_create    - set up the page table of a new address space.
+ *
+ *    pt_destroy   - dispose of the page table of an address space that
+ *                   has no entries left.
+ *
+ *    pt_lock      - lock the entry for VADDR in AS. Entries may only be
+ *    pt_unlock      looked up, inserted, changed or removed with their
+ *                   lock held. Nothing that can sleep may be called
+ *                   while holding it. The lock must not live in
+ *                   memory freed by pt_destroy, since the pager may
+ *                   take it for an address space that is going away.
+ *
+ *    pt_get       - return the entry for VADDR in AS, or NULL if there
+ *                   is none.
+ *
+ *    pt_reserve   - allocate whatever pt_insert will need to add an
+ *                   entry for VADDR in AS, so that it need not allocate
+ *                   memory with the entry's lock held. Called without
+ *                   the lock; returns ENOMEM if memory is short. May be
+ *                   NULL if pt_insert never allocates.
+ *
+ *    pt_insert    - add an entry for VADDR in AS, which must not have
+ *                   one, and return it, or NULL if there is no room.
+ *                   pt_reserve has been called for it first.
+ *
+ *    pt_remove    - remove the entry for VADDR in AS.
+ *
+ *    pt_find_frame - find an address space and page mapping the frame
+ *                   at PADDR, without holding any locks afterwards.
+ *                   Used by the pager when a frame's reverse mapping
+ *                   is unknown; a backend that cannot search may
+ *                   always return false.
+ *
+ *    pt_printstats - print chain lengths and memory used.
+ */
+struct pagetable_ops {
+        const char *pt_name;
+        void (*pt_bootstrap)(void);
+        int (*pt_create)(struct addrspace *as);
+        void (*pt_destroy)(struct addrspace *as);
+        void (*pt_lock)(struct addrspace *as, vaddr_t vaddr);
+        void (*pt_unlock)(struct addrspace *as, vaddr_t vaddr);
+        struct pte *(*pt_get)(struct addrspace *as, vaddr_t vaddr);
+        int (*pt_reserve)(struct addrspace *as, vaddr_t vaddr);
+        struct pte *(*pt_insert)(struct addrspace *as, vaddr_t vaddr,
+                                 uint32_t entrylo);
+        void (*pt_remove)(struct addrspace *as, vaddr_t vaddr);
+        bool (*pt_find_frame)(paddr_t paddr, struct addrspace **as,
+                              vaddr_t *vaddr);
+        void (*pt_printstats)(void);
+};
+
+/* The backends */
+extern const struct pagetable_ops hashed_pagetable;
+extern const struct pagetable_ops twolevel_pagetable;
+extern const struct pagetable_ops inverted_pagetable;
+
+/* The configured backend (see vm.c) */
+extern const struct pagetable_ops *const pagetable;
+
+#endif /* _PAGETABLE_H_ */
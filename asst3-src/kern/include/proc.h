@@ -40,6 +40,7 @@
 #include <thread.h> /* required for struct threadarray */
 
 struct addrspace;
+struct semaphore;
 struct vnode;
 
 /*
@@ -60,6 +61,7 @@ struct proc {
 
 	/* VM */
 	struct addrspace *p_addrspace;	/* virtual address space */
+	struct semaphore *p_vforksem;	/* parent waiting for it, if vforked */
 
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
@@ -80,9 +82,15 @@ int proc_create_runprogram(const char *name, struct proc **ret);
 /* Create a fresh process for use by fork() */
 int proc_fork(struct proc **ret);
 
+/* Create a process for vfork(), sharing the current address space */
+int proc_vfork(struct proc **ret, struct semaphore *done);
+
 /* Undo proc_fork if nothing's run in the new process yet. */
 void proc_unfork(struct proc *proc);
 
+/* Give a vforked process's address space back to its parent. */
+void proc_vforkdone(struct proc *proc);
+
 /* Destroy a process. */
 void proc_destroy(struct proc *proc);
 
@@ -0,0 +1,35 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap space management.
+ *
+ * User pages are paged out to the swap device when alloc_upage() finds
+ * memory all but full, so that the kernel, which never pages anything
+ * out itself, is left some frames. The device is split into page-sized
+ * slots, tracked with a bitmap.
+ */
+
+struct addrspace;
+
+#define SWAP_DEVICE "lhd0:"     // raw disk used for swap, if present
+#define SWAP_RESERVE 32         // free frames user pages leave to the kernel
+
+/* Attach the swap device; paging is disabled if there isn't one */
+void swap_bootstrap(void);
+
+/* Number of page-sized slots on the swap device (0 without one) */
+uint32_t swap_size(void);
+
+/*
+ * Allocate a frame for the user page VADDR of AS, paging another page
+ * out if memory is nearly full. The frame is returned pinned (see
+ * frame_unpin()), or 0 if neither memory nor swap is left.
+ */
+vaddr_t alloc_upage(struct addrspace *as, vaddr_t vaddr);
+
+/* Move a page between a frame and a swap slot */
+int swap_read(uint32_t slot, vaddr_t kvaddr);
+void swap_free(uint32_t slot);
+
+#endif /* _SWAP_H_ */
@@ -66,11 +66,18 @@ int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
 
 int sys_fork(struct trapframe *tf, pid_t *retval);
+int sys_vfork(struct trapframe *tf, pid_t *retval);
 int sys_execv(userptr_t prog, userptr_t args);
 __DEAD void sys__exit(int code);
 int sys_waitpid(pid_t pid, userptr_t returncode, int flags, pid_t *retval);
 int sys_getpid(pid_t *retval);
 
+int sys_sbrk(intptr_t amount, vaddr_t *retval);
+int sys_mmap(size_t length, int prot, int fd, off_t offset, vaddr_t *retval);
+int sys_munmap(vaddr_t addr);
+int sys_msync(vaddr_t addr);
+int sys_vmstat(userptr_t statptr);
+
 int sys_open(const_userptr_t filename, int flags, mode_t mode, int *retval);
 int sys_dup2(int oldfd, int newfd, int *retval);
 int sys_close(int fd);
@@ -96,6 +96,10 @@ int kmalloctest(int, char **);
 int kmallocstress(int, char **);
 int kmalloctest3(int, char **);
 int kmalloctest4(int, char **);
+int vmstress(int, char **);
+int frametest(int, char **);
+int vmexitbench(int, char **);
+int ptbench(int, char **);
 int nettest(int, char **);
 
 /* Routine for running a user-level program. */
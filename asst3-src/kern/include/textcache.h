@@ -0,0 +1,52 @@
+#ifndef _TEXTCACHE_H_
+#define _TEXTCACHE_H_
+
+/*
+ * Cache of the read-only pages of executables.
+ *
+ * Pages of read-only program segments (code, mostly) are read from the
+ * executable once and then shared, frame and all, by every process that
+ * runs it, instead of being read into private frames for each one. The
+ * cache keeps a reference to each frame; the page table entries mapping
+ * it hold the others (see ref_kpage()). Cached frames are never paged
+ * out, but those only the cache still uses are given back when frames
+ * run out; once a frame leaves the cache, the processes still mapping
+ * it may have it paged out as usual.
+ */
+
+#include "opt-dumbvm.h"
+
+struct vnode;
+struct as_regions;
+
+#define TEXTCACHE_MAXPAGES 256  // pages kept at most
+#define TEXTCACHE_FILES 16      // executables kept at most
+#define TEXTCACHE_BUCKETS 64    // hash chains, by file and offset
+
+#if OPT_DUMBVM
+#define textcache_invalidate(vn) ((void)(vn))
+#else
+/*
+ * Look up the page at vaddr of a region; returns its frame with a
+ * reference taken for the caller, or 0 if it is not cached (or the
+ * region cannot be shared). On a miss, *generation is to be passed
+ * on to textcache_put().
+ */
+vaddr_t textcache_get(struct as_regions *region, vaddr_t vaddr,
+                      unsigned *generation);
+
+/* Offer the newly read-in page at vaddr of a region to the cache */
+void textcache_put(struct as_regions *region, vaddr_t vaddr, vaddr_t frame,
+                   unsigned generation);
+
+/* Forget the pages of a file; called both before and after changing it */
+void textcache_invalidate(struct vnode *vn);
+
+/* Free the frames only the cache uses; returns how many */
+unsigned textcache_reclaim(void);
+
+/* Print the cache's hit and miss counters */
+void textcache_printstats(void);
+#endif
+
+#endif /* _TEXTCACHE_H_ */
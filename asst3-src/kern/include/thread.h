@@ -64,6 +64,9 @@ typedef enum {
 	S_ZOMBIE,	/* zombie; exited but not yet deleted */
 } threadstate_t;
 
+/* Number of scheduling priorities (feedback queue levels). */
+#define THREAD_PRIORITIES 4
+
 /* Thread structure. */
 struct thread {
 	/*
@@ -102,6 +105,20 @@ struct thread {
 	int t_curspl;			/* Current spl*() state */
 	int t_iplhigh_count;		/* # of times IPL has been raised */
 
+	/*
+	 * Scheduler fields; see schedule() in thread.c. Only changed
+	 * by the thread's own cpu, with interrupts off.
+	 */
+	unsigned t_priority;		/* 0 (highest) to THREAD_PRIORITIES-1 */
+	unsigned t_quantum;		/* Hardclocks left before demotion */
+	bool t_background;		/* Kept at the lowest priority */
+
+	/*
+	 * User stack pointer as of the thread's last trap from user
+	 * mode, for deciding whether a fault may grow the stack.
+	 */
+	vaddr_t t_usersp;
+
 	/*
 	 * Public fields
 	 */
@@ -131,6 +148,9 @@ void thread_panic(void);
 /* Call during system shutdown to offline other CPUs. */
 void thread_shutdown(void);
 
+/* Print hit rate of the per-cpu pools of reusable threads. */
+void thread_printpoolstats(void);
+
 /*
  * Make a new thread, which will start executing at "func". The thread
  * will belong to the process "proc", or to the current thread's
@@ -158,6 +178,26 @@ __DEAD void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Return true if other threads are waiting to run on the current
+ * cpu. Lets background threads stay out of the way of real work.
+ */
+bool thread_cpu_busy(void);
+
+/*
+ * Move the current thread to the lowest priority for good: it is
+ * neither promoted for sleeping nor boosted by schedule(), so it
+ * only gets the cpu when nothing else wants it.
+ */
+void thread_set_background(void);
+
+/*
+ * Charge a clock tick to the current thread, and preempt it if its
+ * quantum is used up or a thread of higher priority is waiting.
+ * Called from the timer interrupt.
+ */
+void thread_tick(void);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
@@ -37,6 +37,9 @@
 // ==============================================
 
 #define VM_STACKPAGES 16 // As per specification
+#define VM_STACKMAX (8 * 1024 * 1024) // The stack grows on demand up to this size
+#define VM_STACKGUARD 4 // Pages kept free between the heap and the stack
+#define VM_STACKSLACK 2 // Pages below the stack pointer a fault may grow the stack to
 
 // ==============================================
 
@@ -49,15 +52,7 @@
 
 // ==============================================
 
-struct hpt_entry {
-        int pid;
-        uint32_t entrylo;
-        uint32_t entryhi;
-        struct hpt_entry *next;
-};
-
-// global hashed page table
-struct hpt_entry* hpt;
+// page table entries and backends are in pagetable.h
 
 // ==============================================
 
@@ -67,11 +62,40 @@ void vm_bootstrap(void);
 /* Fault handling function called by trap code */
 int vm_fault(int faulttype, vaddr_t faultaddress);
 
+/* Number of following resident pages to preload into the TLB on a fault */
+int vm_set_faultaround(unsigned npages);
+
+/* Print the VM counters (see vmstats.h) */
+void vm_printstats(void);
+
 /* Allocate/free kernel heap pages (called by kmalloc/kfree) */
 
 vaddr_t alloc_kpages(unsigned npages);
 void free_kpages(vaddr_t addr);
 
+/* Share a single user frame between page table entries (copy-on-write) */
+void ref_kpage(vaddr_t addr);
+unsigned kpage_refcount(vaddr_t addr);
+
+/* Reverse mappings and victim selection for the pager (see swap.c) */
+struct addrspace;
+void frame_set_owner(vaddr_t addr, struct addrspace *as, vaddr_t vaddr);
+void frame_clear_owner(vaddr_t addr, struct addrspace *as);
+void frame_unpin(vaddr_t addr);
+void frame_keep_resident(vaddr_t addr);
+void frame_allow_paging(vaddr_t addr);
+void frame_touch(vaddr_t addr);
+vaddr_t frame_choose_victim(struct addrspace **as, vaddr_t *vaddr);
+bool frame_evictable(vaddr_t addr);
+void frame_release_victim(vaddr_t addr);
+
+/* Fill in the frame counts of a struct vmstats */
+struct vmstats;
+void frame_usage(struct vmstats *vs);
+
+/* Number of free frames, cheaply and roughly */
+unsigned frame_free_count(void);
+
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
 
@@ -0,0 +1,37 @@
+#ifndef _VMSTATS_H_
+#define _VMSTATS_H_
+
+/*
+ * VM event counters (see <kern/vmstats.h>).
+ *
+ * Each CPU counts in its own struct vmstats, with interrupts off, so
+ * counting takes no lock and never contends. vmstats_get() adds them
+ * up; its total may be a few events out while other CPUs are busy.
+ */
+
+#include <kern/vmstats.h>
+#include <spl.h>
+#include <current.h>
+#include <cpu.h>
+#include <platform/maxcpus.h>
+
+extern struct vmstats vmstats_cpu[MAXCPUS];
+
+/* Count N events of the kind FIELD names on this CPU */
+#define VMSTAT_ADD(field, n) do { \
+        if (CURCPU_EXISTS()) { \
+                int vmstat_spl = splhigh(); \
+                vmstats_cpu[curcpu->c_number].field += (n); \
+                splx(vmstat_spl); \
+        } \
+} while (0)
+
+#define VMSTAT_INC(field) VMSTAT_ADD(field, 1)
+
+/* Total the counters of every CPU into VS */
+void vmstats_get(struct vmstats *vs);
+
+/* Print the totals */
+void vmstats_print(void);
+
+#endif /* _VMSTATS_H_ */
@@ -0,0 +1,34 @@
+#ifndef _ZEROPOOL_H_
+#define _ZEROPOOL_H_
+
+/*
+ * Pool of pre-zeroed frames.
+ *
+ * A kernel thread zeroes free frames while its cpu has nothing else to
+ * run, so that page faults on new anonymous pages need not bzero a
+ * frame themselves.
+ */
+
+#define ZEROPOOL_SIZE 32        // frames kept zeroed
+#define ZEROPOOL_LOW  16        // refill once the pool falls below this
+
+/* Start the zeroing thread */
+void zeropool_bootstrap(void);
+
+/*
+ * Take a zeroed frame out of the pool, or return 0 if it is empty.
+ * The frame is allocated as if by alloc_kpages(1).
+ */
+vaddr_t zeropool_get(void);
+
+/*
+ * Take a frame out of the pool when memory runs short, as for
+ * zeropool_get(), but without counting a hit or miss or refilling the
+ * pool. Returns 0 if it is empty.
+ */
+vaddr_t zeropool_reclaim(void);
+
+/* Print the pool's hit and miss counters */
+void zeropool_printstats(void);
+
+#endif /* _ZEROPOOL_H_ */
@@ -45,6 +45,7 @@
 #include <vm.h>
 #include <mainbus.h>
 #include <vfs.h>
+#include <openfile.h>
 #include <device.h>
 #include <pid.h>
 #include <syscall.h>
@@ -114,6 +115,7 @@ boot(void)
 	pid_bootstrap();
 	hardclock_bootstrap();
 	vfs_bootstrap();
+	openfile_bootstrap();
 	kheap_nextgeneration();
 
 	/* Probe and initialize devices. Interrupts should come on. */
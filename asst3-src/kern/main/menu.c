@@ -45,8 +45,15 @@
 #include <pid.h>
 #include <syscall.h>
 #include <test.h>
+#include <kmemcache.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-dumbvm.h"
+
+#if !OPT_DUMBVM
+#include <vm.h>
+#include <zeropool.h>
+#endif
 
 /*
  * In-kernel menu and command dispatcher.
@@ -471,6 +478,19 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_kcachestats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kmem_cache_printstats();
+	thread_printpoolstats();
+
+	return 0;
+}
+
 static
 int
 cmd_kheapgeneration(int nargs, char **args)
@@ -500,6 +520,46 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+#if !OPT_DUMBVM
+static
+int
+cmd_zeropoolstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	zeropool_printstats();
+
+	return 0;
+}
+
+/*
+ * Command for printing the VM counters, optionally setting the
+ * number of pages preloaded by fault-around first.
+ */
+static
+int
+cmd_vmstats(int nargs, char **args)
+{
+	int result;
+
+	if (nargs > 2) {
+		kprintf("Usage: vm [faultaround-pages]\n");
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		result = vm_set_faultaround(atoi(args[1]));
+		if (result) {
+			return result;
+		}
+	}
+
+	vm_printstats();
+
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -566,6 +626,12 @@ static const char *testmenu[] = {
 	"[km2] kmalloc stress test           ",
 	"[km3] Large kmalloc test            ",
 	"[km4] Multipage kmalloc test        ",
+	"[vm1] VM concurrent fault stress    ",
+	"[fa1] Frame allocator latency test  ",
+#if !OPT_DUMBVM
+	"[vm2] Address space teardown bench  ",
+	"[vm3] Page table benchmark          ",
+#endif
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
@@ -606,6 +672,11 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[kc] Kernel object cache stats      ",
+#if !OPT_DUMBVM
+	"[zp] Zeroed page pool stats         ",
+	"[vm] VM stats/set fault-around      ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -657,6 +728,11 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "kc",         cmd_kcachestats },
+#if !OPT_DUMBVM
+	{ "zp",         cmd_zeropoolstats },
+	{ "vm",         cmd_vmstats },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -667,6 +743,12 @@ static struct {
 	{ "km2",	kmallocstress },
 	{ "km3",	kmalloctest3 },
 	{ "km4",	kmalloctest4 },
+	{ "vm1",	vmstress },
+	{ "fa1",	frametest },
+#if !OPT_DUMBVM
+	{ "vm2",	vmexitbench },
+	{ "vm3",	ptbench },
+#endif
 #if OPT_NET
 	{ "net",	nettest },
 #endif
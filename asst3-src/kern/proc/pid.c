@@ -43,6 +43,7 @@
 #include <current.h>
 #include <synch.h>
 #include <pid.h>
+#include <kmemcache.h>
 
 /*
  * Structure for holding exit data of a thread.
@@ -73,6 +74,34 @@ static struct pidinfo *pidinfo[PROCS_MAX]; // actual pid info
 static pid_t nextpid;			// next candidate pid
 static int nprocs;			// number of allocated pids
 
+/*
+ * Cache of pidinfo structures, with their cvs.
+ */
+#define PIDINFO_CACHE_MAX 16
+
+static struct kmem_cache *pidinfo_cache;
+
+static
+int
+pidinfo_ctor(void *obj)
+{
+	struct pidinfo *pi = obj;
+
+	pi->pi_cv = cv_create("pidinfo cv");
+	if (pi->pi_cv == NULL) {
+		return ENOMEM;
+	}
+	return 0;
+}
+
+static
+void
+pidinfo_dtor(void *obj)
+{
+	struct pidinfo *pi = obj;
+
+	cv_destroy(pi->pi_cv);
+}
 
 
 /*
@@ -86,17 +115,11 @@ pidinfo_create(pid_t pid, pid_t ppid)
 
 	KASSERT(pid != INVALID_PID);
 
-	pi = kmalloc(sizeof(struct pidinfo));
+	pi = kmem_cache_alloc(pidinfo_cache);
 	if (pi==NULL) {
 		return NULL;
 	}
 
-	pi->pi_cv = cv_create("pidinfo cv");
-	if (pi->pi_cv == NULL) {
-		kfree(pi);
-		return NULL;
-	}
-
 	pi->pi_pid = pid;
 	pi->pi_ppid = ppid;
 	pi->pi_exited = false;
@@ -114,8 +137,7 @@ pidinfo_destroy(struct pidinfo *pi)
 {
 	KASSERT(pi->pi_exited == true);
 	KASSERT(pi->pi_ppid == INVALID_PID);
-	cv_destroy(pi->pi_cv);
-	kfree(pi);
+	kmem_cache_free(pidinfo_cache, pi);
 }
 
 ////////////////////////////////////////////////////////////
@@ -133,6 +155,13 @@ pid_bootstrap(void)
 		panic("Out of memory creating pid lock\n");
 	}
 
+	pidinfo_cache = kmem_cache_create("pidinfo", sizeof(struct pidinfo),
+					  PIDINFO_CACHE_MAX, pidinfo_ctor,
+					  pidinfo_dtor);
+	if (pidinfo_cache == NULL) {
+		panic("Out of memory creating pidinfo cache\n");
+	}
+
 	/* not really necessary - should start zeroed */
 	for (i=0; i<PROCS_MAX; i++) {
 		pidinfo[i] = NULL;
@@ -52,12 +52,47 @@
 #include <vnode.h>
 #include <pid.h>
 #include <filetable.h>
+#include <kmemcache.h>
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
  */
 struct proc *kproc;
 
+/*
+ * Cache of proc structures, with their threads lock and array kept
+ * from one process to the next.
+ */
+#define PROC_CACHE_MAX 16
+
+static struct kmem_cache *proc_cache;
+
+static
+int
+proc_ctor(void *obj)
+{
+	struct proc *proc = obj;
+
+	proc->p_threadslock = lock_create("p_threads");
+	if (proc->p_threadslock == NULL) {
+		return ENOMEM;
+	}
+	threadarray_init(&proc->p_threads);
+	spinlock_init(&proc->p_lock);
+	return 0;
+}
+
+static
+void
+proc_dtor(void *obj)
+{
+	struct proc *proc = obj;
+
+	spinlock_cleanup(&proc->p_lock);
+	threadarray_cleanup(&proc->p_threads);
+	lock_destroy(proc->p_threadslock);
+}
+
 /*
  * Create a proc structure.
  */
@@ -67,29 +102,22 @@ proc_create(const char *name)
 {
 	struct proc *proc;
 
-	proc = kmalloc(sizeof(*proc));
+	proc = kmem_cache_alloc(proc_cache);
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
-		kfree(proc);
+		kmem_cache_free(proc_cache, proc);
 		return NULL;
 	}
 
-	proc->p_threadslock = lock_create("p_threads");
-	if (proc->p_threadslock == NULL) {
-		kfree(proc->p_name);
-		kfree(proc);
-		return NULL;
-	}
-	threadarray_init(&proc->p_threads);
-
-	spinlock_init(&proc->p_lock);
+	KASSERT(threadarray_num(&proc->p_threads) == 0);
 	proc->p_pid = INVALID_PID;
 
 	/* VM fields */
 	proc->p_addrspace = NULL;
+	proc->p_vforksem = NULL;
 
 	/* VFS fields */
 	proc->p_cwd = NULL;
@@ -179,16 +207,20 @@ proc_destroy(struct proc *proc)
 			as = proc->p_addrspace;
 			proc->p_addrspace = NULL;
 		}
-		as_destroy(as);
+		if (proc->p_vforksem != NULL) {
+			/* It belongs to our vfork parent; hand it back. */
+			proc_vforkdone(proc);
+		}
+		else {
+			as_destroy(as);
+		}
 	}
 
 	KASSERT(proc->p_pid == INVALID_PID);
-	spinlock_cleanup(&proc->p_lock);
-	threadarray_cleanup(&proc->p_threads);
-	lock_destroy(proc->p_threadslock);
+	KASSERT(threadarray_num(&proc->p_threads) == 0);
 
 	kfree(proc->p_name);
-	kfree(proc);
+	kmem_cache_free(proc_cache, proc);
 }
 
 /*
@@ -197,6 +229,12 @@ proc_destroy(struct proc *proc)
 void
 proc_bootstrap(void)
 {
+	proc_cache = kmem_cache_create("proc", sizeof(struct proc),
+				       PROC_CACHE_MAX, proc_ctor, proc_dtor);
+	if (proc_cache == NULL) {
+		panic("proc_bootstrap: cannot create proc cache\n");
+	}
+
 	kproc = proc_create("[kernel]");
 	if (kproc == NULL) {
 		panic("proc_create for kproc failed\n");
@@ -261,9 +299,13 @@ proc_create_runprogram(const char *name, struct proc **ret)
  * However, the new thread always inherits its current working
  * directory from the caller. The new thread is given no address space
  * (the caller decides that).
+ *
+ * If VFORKSEM is not null, the new process shares the caller's
+ * address space instead of getting a copy; see proc_vfork.
  */
+static
 int
-proc_fork(struct proc **ret)
+proc_clone(struct proc **ret, struct semaphore *vforksem)
 {
 	struct proc *newproc;
 	struct addrspace *as;
@@ -293,7 +335,7 @@ proc_fork(struct proc **ret)
 
 	/* VM fields */
 	as = proc_getas();
-	if (as != NULL) {
+	if (as != NULL && vforksem == NULL) {
 		result = as_copy(as, &newproc->p_addrspace);
 		if (result) {
 			pid_unalloc(newproc->p_pid);
@@ -308,8 +350,10 @@ proc_fork(struct proc **ret)
 	if (tbl != NULL) {
 		result = filetable_copy(tbl, &newproc->p_filetable);
 		if (result) {
-			as_destroy(newproc->p_addrspace);
-			newproc->p_addrspace = NULL;
+			if (newproc->p_addrspace != NULL) {
+				as_destroy(newproc->p_addrspace);
+				newproc->p_addrspace = NULL;
+			}
 			pid_unalloc(newproc->p_pid);
 			newproc->p_pid = INVALID_PID;
 			proc_destroy(newproc);
@@ -329,10 +373,38 @@ proc_fork(struct proc **ret)
 	}
 	spinlock_release(&curproc->p_lock);
 
+	if (vforksem != NULL) {
+		newproc->p_addrspace = as;
+		newproc->p_vforksem = vforksem;
+	}
+
 	*ret = newproc;
 	return 0;
 }
 
+/*
+ * Create a process for fork(), with a copy of the caller's address
+ * space.
+ */
+int
+proc_fork(struct proc **ret)
+{
+	return proc_clone(ret, NULL);
+}
+
+/*
+ * Create a process for vfork(). The new process borrows the caller's
+ * address space until it execs or exits, at which point DONE is V'd
+ * (by proc_vforkdone) so the caller, which must not touch the address
+ * space in the meantime, can carry on.
+ */
+int
+proc_vfork(struct proc **ret, struct semaphore *done)
+{
+	KASSERT(done != NULL);
+	return proc_clone(ret, done);
+}
+
 /*
  * Undo proc_fork if nothing's run in the new process yet.
  */
@@ -344,6 +416,22 @@ proc_unfork(struct proc *newproc)
 	proc_destroy(newproc);
 }
 
+/*
+ * Give a vforked process's borrowed address space back to the parent
+ * waiting for it. The process must have stopped using it already:
+ * once the parent wakes up it may change or destroy it.
+ */
+void
+proc_vforkdone(struct proc *proc)
+{
+	struct semaphore *done;
+
+	done = proc->p_vforksem;
+	KASSERT(done != NULL);
+	proc->p_vforksem = NULL;
+	V(done);
+}
+
 /*
  * Make the current process exit.
  */
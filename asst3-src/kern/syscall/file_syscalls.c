@@ -47,6 +47,7 @@
 #include <vnode.h>
 #include <openfile.h>
 #include <filetable.h>
+#include <textcache.h>
 #include <syscall.h>
 
 /*
@@ -146,9 +147,15 @@ sys_readwrite(int fd, userptr_t buf, size_t size, enum uio_rw rw,
 	uio_uinit(&iov, &useruio, buf, size, pos, rw);
 
 	/* do the read or write */
-	result = (rw == UIO_READ) ?
-		VOP_READ(file->of_vnode, &useruio) :
-		VOP_WRITE(file->of_vnode, &useruio);
+	if (rw == UIO_READ) {
+		result = VOP_READ(file->of_vnode, &useruio);
+	}
+	else {
+		/* new runs of the file must not see stale pages */
+		textcache_invalidate(file->of_vnode);
+		result = VOP_WRITE(file->of_vnode, &useruio);
+		textcache_invalidate(file->of_vnode);
+	}
 	if (result) {
 		goto fail;
 	}
@@ -47,6 +47,7 @@
 #include <vnode.h>
 #include <openfile.h>
 #include <filetable.h>
+#include <textcache.h>
 #include <syscall.h>
 
 /*
@@ -423,7 +424,9 @@ sys_ftruncate(int fd, off_t len)
 	 * and we're not using any of its non-constant fields.
 	 */
 
+	textcache_invalidate(file->of_vnode);
 	err = VOP_TRUNCATE(file->of_vnode, len);
+	textcache_invalidate(file->of_vnode);
 	filetable_put(curproc->p_filetable, fd, file);
 	return err;
 }
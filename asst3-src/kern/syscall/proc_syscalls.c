@@ -38,6 +38,7 @@
 #include <machine/trapframe.h>
 #include <clock.h>
 #include <thread.h>
+#include <synch.h>
 #include <proc.h>
 #include <current.h>
 #include <copyinout.h>
@@ -100,8 +101,14 @@ fork_newthread(void *vtf, unsigned long junk)
 	enter_forked_process(&mytf);
 }
 
+/*
+ * Common code for fork and vfork: make the new process and start its
+ * thread. If VFORKSEM is not null, the new process borrows our
+ * address space.
+ */
+static
 int
-sys_fork(struct trapframe *tf, pid_t *retval)
+dofork(struct trapframe *tf, struct semaphore *vforksem, pid_t *retval)
 {
 	struct trapframe *ntf;
 	int result;
@@ -119,7 +126,12 @@ sys_fork(struct trapframe *tf, pid_t *retval)
 	}
 	*ntf = *tf;
 
-	result = proc_fork(&newproc);
+	if (vforksem != NULL) {
+		result = proc_vfork(&newproc, vforksem);
+	}
+	else {
+		result = proc_fork(&newproc);
+	}
 	if (result) {
 		kfree(ntf);
 		return result;
@@ -137,6 +149,46 @@ sys_fork(struct trapframe *tf, pid_t *retval)
 	return 0;
 }
 
+int
+sys_fork(struct trapframe *tf, pid_t *retval)
+{
+	return dofork(tf, NULL, retval);
+}
+
+/*
+ * sys_vfork
+ *
+ * Like fork, but without copying the address space: the child runs
+ * in ours, and we sleep until it gives it back by calling execv or
+ * exiting. For the shell and system(), which fork only to exec, this
+ * saves copying an address space that would be thrown away at once.
+ *
+ * Since the child also runs on our user stack, it must not do
+ * anything but exec or _exit.
+ */
+int
+sys_vfork(struct trapframe *tf, pid_t *retval)
+{
+	struct semaphore *done;
+	int result;
+
+	done = sem_create("vfork", 0);
+	if (done == NULL) {
+		return ENOMEM;
+	}
+
+	result = dofork(tf, done, retval);
+	if (result) {
+		/* proc_unfork may have V'd it; nobody else has it now */
+		sem_destroy(done);
+		return result;
+	}
+
+	P(done);
+	sem_destroy(done);
+	return 0;
+}
+
 /*
  * sys_waitpid
  * just pass off the work to the pid code.
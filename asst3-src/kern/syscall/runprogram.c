@@ -54,12 +54,27 @@
  * argv buffer.
  *
  * This is an abstraction that holds an argv while it's being shuffled
- * through the kernel during exec.
+ * through the kernel during exec. The strings are kept back to back,
+ * the way they will be laid out on the new user stack, in a list of
+ * page-sized chunks that are added as they fill up; a string can run
+ * on from one chunk into the next. Every exec has its own buffer, and
+ * an argv of ordinary size fits in the first chunk, so ordinary execs
+ * don't wait on each other; only those that need more chunks than that
+ * are throttled.
  */
+struct argchunk {
+	struct argchunk *ac_next;
+	char *ac_data;		/* follows the header */
+	size_t ac_len;		/* bytes of ac_data in use */
+};
+
+#define ARGCHUNK_SIZE	PAGE_SIZE
+#define ARGCHUNK_DATA	(ARGCHUNK_SIZE - sizeof(struct argchunk))
+
 struct argbuf {
-	char *data;
-	size_t len;
-	size_t max;
+	struct argchunk *head;
+	struct argchunk *tail;
+	size_t len;		/* total bytes of strings */
 	int nargs;
 	bool tooksem;
 };
@@ -67,7 +82,9 @@ struct argbuf {
 /*
  * Throttle to limit the number of processes in exec at once. Or,
  * rather, the number trying to use large exec buffers at once. See
- * design notes for the rationale.
+ * design notes for the rationale. A buffer takes the semaphore when it
+ * grows past its first chunk, and keeps it until it is cleaned up, so
+ * at most this many argvs of up to ARG_MAX are in memory at a time.
  */
 #define EXEC_BIGBUF_THROTTLE	1
 static struct semaphore *execthrottle;
@@ -84,6 +101,11 @@ exec_bootstrap(void)
 	}
 }
 
+/*
+ * argv pointers are sent out to the user stack this many at a time.
+ */
+#define ARGBUF_PTRBATCH	32
+
 /*
  * Initialize an argv buffer.
  */
@@ -91,9 +113,9 @@ static
 void
 argbuf_init(struct argbuf *buf)
 {
-	buf->data = NULL;
+	buf->head = NULL;
+	buf->tail = NULL;
 	buf->len = 0;
-	buf->max = 0;
 	buf->nargs = 0;
 	buf->tooksem = false;
 }
@@ -105,12 +127,15 @@ static
 void
 argbuf_cleanup(struct argbuf *buf)
 {
-	if (buf->data != NULL) {
-		kfree(buf->data);
-		buf->data = NULL;
+	struct argchunk *chunk;
+
+	while (buf->head != NULL) {
+		chunk = buf->head;
+		buf->head = chunk->ac_next;
+		kfree(chunk);
 	}
+	buf->tail = NULL;
 	buf->len = 0;
-	buf->max = 0;
 	buf->nargs = 0;
 	if (buf->tooksem) {
 		V(execthrottle);
@@ -119,17 +144,35 @@ argbuf_cleanup(struct argbuf *buf)
 }
 
 /*
- * Allocate the memory for an argv buffer.
+ * Add an empty chunk to the end of an argv buffer.
  */
 static
 int
-argbuf_allocate(struct argbuf *buf, size_t size)
+argbuf_addchunk(struct argbuf *buf)
 {
-	buf->data = kmalloc(size);
-	if (buf->data == NULL) {
+	struct argchunk *chunk;
+
+	if (buf->head != NULL && !buf->tooksem) {
+		/* Wait on the semaphore, to throttle the big buffers */
+		P(execthrottle);
+		buf->tooksem = true;
+	}
+
+	chunk = kmalloc(ARGCHUNK_SIZE);
+	if (chunk == NULL) {
 		return ENOMEM;
 	}
-	buf->max = size;
+	chunk->ac_next = NULL;
+	chunk->ac_data = (char *)(chunk + 1);
+	chunk->ac_len = 0;
+
+	if (buf->tail == NULL) {
+		buf->head = chunk;
+	}
+	else {
+		buf->tail->ac_next = chunk;
+	}
+	buf->tail = chunk;
 	return 0;
 }
 
@@ -147,12 +190,16 @@ argbuf_fromkernel(struct argbuf *buf, const char *progname)
 	int result;
 
 	len = strlen(progname) + 1;
+	if (len > ARGCHUNK_DATA || len > ARG_MAX) {
+		return E2BIG;
+	}
 
-	result = argbuf_allocate(buf, len);
+	result = argbuf_addchunk(buf);
 	if (result) {
 		return result;
 	}
-	strcpy(buf->data, progname);
+	strcpy(buf->tail->ac_data, progname);
+	buf->tail->ac_len = len;
 	buf->len = len;
 	buf->nargs = 1;
 
@@ -164,10 +211,11 @@ argbuf_fromkernel(struct argbuf *buf, const char *progname)
  */
 static
 int
-argbuf_copyin(struct argbuf *buf, userptr_t uargv)
+argbuf_fromuser(struct argbuf *buf, userptr_t uargv)
 {
 	userptr_t thisarg;
-	size_t thisarglen;
+	size_t thisarglen, space;
+	struct argchunk *chunk;
 	int result;
 
 	/* loop through the argv, grabbing each arg string */
@@ -187,18 +235,49 @@ argbuf_copyin(struct argbuf *buf, userptr_t uargv)
 			break;
 		}
 
-		/* Use the pointer to fetch the argument string. */
-		result = copyinstr(thisarg, buf->data + buf->len,
-				   buf->max - buf->len, &thisarglen);
-		if (result == ENAMETOOLONG) {
-			return E2BIG;
-		}
-		else if (result) {
-			return result;
+		/*
+		 * Use the pointer to fetch the argument string. If it
+		 * doesn't fit in what's left of the last chunk, fill
+		 * that up and go on with the rest in a new one.
+		 */
+		while (1) {
+			if (buf->len == ARG_MAX) {
+				return E2BIG;
+			}
+			chunk = buf->tail;
+			if (chunk == NULL || chunk->ac_len == ARGCHUNK_DATA) {
+				result = argbuf_addchunk(buf);
+				if (result) {
+					return result;
+				}
+				chunk = buf->tail;
+			}
+
+			space = ARGCHUNK_DATA - chunk->ac_len;
+			if (space > ARG_MAX - buf->len) {
+				space = ARG_MAX - buf->len;
+			}
+
+			result = copyinstr(thisarg,
+					   chunk->ac_data + chunk->ac_len,
+					   space, &thisarglen);
+			if (result == ENAMETOOLONG) {
+				/* copyinstr filled the space; go on */
+				chunk->ac_len += space;
+				buf->len += space;
+				thisarg += space;
+				continue;
+			}
+			else if (result) {
+				return result;
+			}
+
+			/* Move ahead. Note: thisarglen includes the \0. */
+			chunk->ac_len += thisarglen;
+			buf->len += thisarglen;
+			break;
 		}
 
-		/* Move ahead. Note: thisarglen includes the \0. */
-		buf->len += thisarglen;
 		uargv += sizeof(userptr_t);
 		buf->nargs++;
 	}
@@ -206,50 +285,13 @@ argbuf_copyin(struct argbuf *buf, userptr_t uargv)
 	return 0;
 }
 
-/*
- * Get an argv from user space.
- */
-static
-int
-argbuf_fromuser(struct argbuf *buf, userptr_t uargv)
-{
-	int result;
-
-	/* try with a small buffer */
-	result = argbuf_allocate(buf, PAGE_SIZE);
-	if (result) {
-		return result;
-	}
-
-	/* do the copyin */
-	result = argbuf_copyin(buf, uargv);
-	if (result == E2BIG) {
-		/*
-		 * Try again with the full-size buffer. Just start
-		 * over instead of trying to keep the page we already
-		 * did; this is a bit inefficient but it's not that
-		 * important.
-		 */
-		argbuf_cleanup(buf);
-		argbuf_init(buf);
-
-		/* Wait on the semaphore, to throttle this allocation */
-		P(execthrottle);
-		buf->tooksem = true;
-
-		result = argbuf_allocate(buf, ARG_MAX);
-		if (result) {
-			return result;
-		}
-
-		result = argbuf_copyin(buf, uargv);
-	}
-	return result;
-}
-
 /*
  * Copy an argv out of kernel space to user space.
  *
+ * The strings go out a chunk at a time, in one copyout each, and the
+ * argv pointers ARGBUF_PTRBATCH at a time; each string starts after
+ * the \0 of the previous one.
+ *
  * Note: ustackp is an in/out argument.
  */
 static
@@ -259,9 +301,12 @@ argbuf_copyout(struct argbuf *buf, vaddr_t *ustackp,
 {
 	vaddr_t ustack;
 	userptr_t ustringbase, uargvbase, uargv_i;
-	userptr_t thisarg;
-	size_t thisarglen;
-	size_t pos;
+	userptr_t ptrs[ARGBUF_PTRBATCH];
+	struct argchunk *chunk;
+	size_t pos, i;
+	unsigned nptrs;
+	int nargs;
+	bool argstart;
 	int result;
 
 	/* Begin the stack at the passed in top. */
@@ -270,7 +315,7 @@ argbuf_copyout(struct argbuf *buf, vaddr_t *ustackp,
 	/*
 	 * Allocate space.
 	 *
-	 * buf->pos is the amount of space used by the strings; put that
+	 * buf->len is the amount of space used by the strings; put that
 	 * first, then align the stack, then make space for the argv
 	 * pointers. Allow an extra slot for the ending NULL.
 	 */
@@ -284,34 +329,48 @@ argbuf_copyout(struct argbuf *buf, vaddr_t *ustackp,
 
 	/* Now copy the data out. */
 	pos = 0;
+	nargs = 0;
+	nptrs = 0;
+	argstart = true;
 	uargv_i = uargvbase;
-	while (pos < buf->len) {
-		/* The user address of the string will be ustringbase + pos. */
-		thisarg = ustringbase + pos;
-
-		/* Place it in the argv array. */
-		result = copyout(&thisarg, uargv_i, sizeof(thisarg));
+	for (chunk = buf->head; chunk != NULL; chunk = chunk->ac_next) {
+		/* Push out the strings, or parts of strings, it holds. */
+		result = copyout(chunk->ac_data, ustringbase + pos,
+				 chunk->ac_len);
 		if (result) {
 			return result;
 		}
 
-		/* Push out the string. */
-		result = copyoutstr(buf->data + pos, thisarg,
-				    buf->len - pos, &thisarglen);
-		if (result) {
-			return result;
+		/* Place the ones that start here in the argv array. */
+		for (i = 0; i < chunk->ac_len; i++) {
+			if (argstart) {
+				ptrs[nptrs++] = ustringbase + pos + i;
+				nargs++;
+				argstart = false;
+			}
+			if (chunk->ac_data[i] == '\0') {
+				argstart = true;
+			}
+
+			if (nptrs == ARGBUF_PTRBATCH) {
+				result = copyout(ptrs, uargv_i,
+						 sizeof(ptrs));
+				if (result) {
+					return result;
+				}
+				uargv_i += sizeof(ptrs);
+				nptrs = 0;
+			}
 		}
-
-		/* thisarglen includes the \0 */
-		pos += thisarglen;
-		uargv_i += sizeof(thisarg);
+		pos += chunk->ac_len;
 	}
 	/* Should have come out even... */
 	KASSERT(pos == buf->len);
+	KASSERT(nargs == buf->nargs);
 
-	/* Add the NULL. */
-	thisarg = NULL;
-	result = copyout(&thisarg, uargv_i, sizeof(userptr_t));
+	/* Add the NULL. There's always room for it. */
+	ptrs[nptrs++] = NULL;
+	result = copyout(ptrs, uargv_i, nptrs * sizeof(userptr_t));
 	if (result) {
 		return result;
 	}
@@ -390,8 +449,14 @@ loadexec(char *path, vaddr_t *entrypoint, vaddr_t *stackptr)
 	 *
 	 * Note: once this is done, execv() must not fail, because there's
 	 * nothing left for it to return an error to.
+	 *
+	 * If we were vforked the old address space is our parent's;
+	 * give it back instead.
 	 */
-	if (oldvm) {
+	if (curproc->p_vforksem != NULL) {
+		proc_vforkdone(curproc);
+	}
+	else if (oldvm) {
 		as_destroy(oldvm);
 	}
 
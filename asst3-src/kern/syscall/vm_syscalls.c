@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Virtual memory system calls.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include <openfile.h>
+#include <filetable.h>
+#include <syscall.h>
+#include <vmstats.h>
+
+/*
+ * sbrk: move the end of the process's heap by AMOUNT bytes, and
+ * return where it was before.
+ */
+int
+sys_sbrk(intptr_t amount, vaddr_t *retval)
+{
+	struct addrspace *as;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+
+	return as_sbrk(as, amount, retval);
+}
+
+/*
+ * mmap: map LENGTH bytes of the open file FD, from OFFSET on, into
+ * the process. PROT holds the access wanted and, optionally,
+ * MAP_PRIVATE or MAP_SHARED (the default). With MAP_ANON the memory
+ * is zero-filled instead, and FD and OFFSET are ignored; a shared
+ * anonymous mapping is shared with the process's children after fork.
+ * The kernel chooses where the mapping goes and returns its address.
+ * Separate mappings of the same file do not share pages; each keeps
+ * its own until changes are written back (see mmap(2)).
+ */
+int
+sys_mmap(size_t length, int prot, int fd, off_t offset, vaddr_t *retval)
+{
+	struct addrspace *as;
+	struct openfile *file;
+	int permissions, type;
+	int result;
+
+	if (prot & ~(PROT_READ | PROT_WRITE | MAP_SHARED | MAP_PRIVATE |
+		     MAP_ANON)) {
+		return EINVAL;
+	}
+	if ((prot & MAP_SHARED) && (prot & MAP_PRIVATE)) {
+		return EINVAL;
+	}
+	type = (prot & MAP_PRIVATE) ? REGION_PRIVATE : REGION_SHARED;
+
+	permissions = 0;
+	if (prot & PROT_READ) {
+		permissions |= READ;
+	}
+	if (prot & PROT_WRITE) {
+		permissions |= WRITE;
+	}
+
+	as = proc_getas();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+
+	if (prot & MAP_ANON) {
+		return as_mmap(as, length, permissions, type, NULL, 0,
+			       retval);
+	}
+
+	result = filetable_get(curproc->p_filetable, fd, &file);
+	if (result) {
+		return result;
+	}
+
+	/*
+	 * Pages are always read from the file, and written to it as
+	 * well if changes to them are shared.
+	 */
+	if (file->of_accmode == O_WRONLY ||
+	    (type == REGION_SHARED && (prot & PROT_WRITE) &&
+	     file->of_accmode == O_RDONLY)) {
+		filetable_put(curproc->p_filetable, fd, file);
+		return EACCES;
+	}
+
+	result = as_mmap(as, length, permissions, type, file->of_vnode,
+			 offset, retval);
+	filetable_put(curproc->p_filetable, fd, file);
+	return result;
+}
+
+/*
+ * munmap: remove the mapping starting at ADDR, as returned by mmap.
+ */
+int
+sys_munmap(vaddr_t addr)
+{
+	struct addrspace *as;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EINVAL;
+	}
+
+	return as_munmap(as, addr);
+}
+
+/*
+ * msync: write the changes to the shared mapping starting at ADDR
+ * back to its file.
+ */
+int
+sys_msync(vaddr_t addr)
+{
+	struct addrspace *as;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EINVAL;
+	}
+
+	return as_msync(as, addr);
+}
+
+/*
+ * vmstat: copy the VM counters, totalled over every CPU, out to
+ * STATPTR.
+ */
+int
+sys_vmstat(userptr_t statptr)
+{
+	struct vmstats vs;
+
+	vmstats_get(&vs);
+	return copyout(&vs, statptr, sizeof(vs));
+}
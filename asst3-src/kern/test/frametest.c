@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Test code for the physical frame allocator.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <vm.h>
+#include <test.h>
+
+////////////////////////////////////////////////////////////
+// fa1
+
+/*
+ * Measure the latency of alloc_kpages() and free_kpages() with memory
+ * 90% full. All free memory is first taken a page at a time, then
+ * every tenth page is given back, which leaves the free memory as
+ * scattered as it can be. The test then times allocating and freeing
+ * blocks of 1, 2 and 4 pages NROUNDS times each, counting the
+ * multi-page allocations that fail because no block of that size is
+ * free. Finally it gives everything back and checks that the free
+ * pages were merged again by allocating a large block.
+ *
+ * The free pages are kept on a list threaded through their first word,
+ * so the test needs no memory of its own.
+ */
+
+#define NROUNDS    1000
+#define NSIZES     3
+#define BIGBLOCK   64
+
+static
+uint64_t
+frametest_nsecs(const struct timespec *start)
+{
+	struct timespec now, diff;
+
+	gettime(&now);
+	timespec_sub(&now, start, &diff);
+	return (uint64_t)diff.tv_sec * 1000000000 + diff.tv_nsec;
+}
+
+int
+frametest(int nargs, char **args)
+{
+	static const unsigned sizes[NSIZES] = { 1, 2, 4 };
+	struct timespec start;
+	uint64_t allocns, freens;
+	vaddr_t head, page, prev, next, block;
+	unsigned npages, nfreed, failed, i, j;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting frame allocator test...\n");
+
+	/* Fill memory. */
+	head = 0;
+	npages = 0;
+	while ((page = alloc_kpages(1)) != 0) {
+		*(vaddr_t *)page = head;
+		head = page;
+		npages++;
+	}
+	if (npages < 10) {
+		kprintf("frametest: only %u free pages\n", npages);
+		while (head != 0) {
+			next = *(vaddr_t *)head;
+			free_kpages(head);
+			head = next;
+		}
+		return ENOMEM;
+	}
+
+	/* Give back every tenth page. */
+	nfreed = 0;
+	prev = 0;
+	page = head;
+	for (i = 0; page != 0; i++) {
+		next = *(vaddr_t *)page;
+		if (i % 10 == 0) {
+			if (prev == 0) {
+				head = next;
+			}
+			else {
+				*(vaddr_t *)prev = next;
+			}
+			free_kpages(page);
+			nfreed++;
+		}
+		else {
+			prev = page;
+		}
+		page = next;
+	}
+	kprintf("frametest: %u of %u free pages in use\n",
+		npages - nfreed, npages);
+
+	for (i = 0; i < NSIZES; i++) {
+		allocns = freens = 0;
+		failed = 0;
+		for (j = 0; j < NROUNDS; j++) {
+			gettime(&start);
+			block = alloc_kpages(sizes[i]);
+			allocns += frametest_nsecs(&start);
+			if (block == 0) {
+				failed++;
+				continue;
+			}
+			gettime(&start);
+			free_kpages(block);
+			freens += frametest_nsecs(&start);
+		}
+		if (sizes[i] == 1 && failed > 0) {
+			kprintf("frametest: single page allocation failed\n");
+			panic("frametest: failed.\n");
+		}
+		kprintf("frametest: %u page(s): alloc %llu ns, free %llu ns, "
+			"%u of %u failed\n", sizes[i],
+			allocns / NROUNDS,
+			NROUNDS > failed ? freens / (NROUNDS - failed) : 0,
+			failed, NROUNDS);
+	}
+
+	/* Give everything back. */
+	while (head != 0) {
+		next = *(vaddr_t *)head;
+		free_kpages(head);
+		head = next;
+	}
+
+	/* The scattered pages should have merged again. */
+	if (npages >= 2 * BIGBLOCK) {
+		block = alloc_kpages(BIGBLOCK);
+		if (block == 0) {
+			kprintf("frametest: cannot allocate %u pages after "
+				"freeing everything\n", BIGBLOCK);
+			panic("frametest: failed.\n");
+		}
+		free_kpages(block);
+	}
+
+	kprintf("frametest: passed\n");
+	return 0;
+}
@@ -33,6 +33,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <clock.h>
 #include <thread.h>
 #include <synch.h>
 #include <vm.h> /* for PAGE_SIZE */
@@ -52,7 +53,8 @@
  * available memory.
  *
  * kmallocstress does the same thing, but from NTHREADS different
- * threads at once.
+ * threads at once, and reports how long it took; with more cpus it
+ * should take less.
  */
 
 #define NTRIES   1200
@@ -115,6 +117,7 @@ int
 kmallocstress(int nargs, char **args)
 {
 	struct semaphore *sem;
+	struct timespec start, end, diff;
 	int i, result;
 
 	(void)nargs;
@@ -127,6 +130,7 @@ kmallocstress(int nargs, char **args)
 
 	kprintf("Starting kmalloc stress test...\n");
 
+	gettime(&start);
 	for (i=0; i<NTHREADS; i++) {
 		result = thread_fork("kmallocstress", NULL,
 				     kmallocthread, sem, i);
@@ -139,9 +143,13 @@ kmallocstress(int nargs, char **args)
 	for (i=0; i<NTHREADS; i++) {
 		P(sem);
 	}
+	gettime(&end);
+	timespec_sub(&end, &start, &diff);
 
 	sem_destroy(sem);
-	kprintf("kmalloc stress test done\n");
+	kprintf("kmalloc stress test done: %d threads, %llu.%09lu seconds\n",
+		NTHREADS, (unsigned long long)diff.tv_sec,
+		(unsigned long)diff.tv_nsec);
 
 	return 0;
 }
@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * VM benchmarks.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <test.h>
+
+#define VMBENCH_BASE  0x10000000
+
+static
+uint64_t
+vmbench_nsecs(const struct timespec *start)
+{
+	struct timespec now, diff;
+
+	gettime(&now);
+	timespec_sub(&now, start, &diff);
+	return (uint64_t)diff.tv_sec * 1000000000 + diff.tv_nsec;
+}
+
+////////////////////////////////////////////////////////////
+// vm2
+
+/*
+ * Time fork and exit (as_copy() and as_destroy()) of a dense address
+ * space, whose one region is all resident, against a sparse one with
+ * the same number of resident pages spread over a region
+ * EXITBENCH_SPARSE times as large. Both should take about the same
+ * time, since only resident pages are visited.
+ *
+ * The pages are entered straight into the page table, so no process
+ * is needed.
+ */
+
+#define EXITBENCH_ROUNDS  32
+#define EXITBENCH_PAGES   32	/* resident pages in each address space */
+#define EXITBENCH_SPARSE  256	/* region pages per resident page, sparse */
+
+static
+int
+exitbench_build(unsigned stride, struct addrspace **ret)
+{
+	struct addrspace *as;
+	vaddr_t frame;
+	unsigned i;
+	int result;
+
+	as = as_create();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+	result = as_define_region(as, VMBENCH_BASE,
+				  EXITBENCH_PAGES * stride * PAGE_SIZE,
+				  1, 1, 0);
+	if (result) {
+		as_destroy(as);
+		return result;
+	}
+	for (i=0; i<EXITBENCH_PAGES; i++) {
+		result = hpt_add(as, VMBENCH_BASE + i * stride * PAGE_SIZE,
+				 READ | WRITE, &frame);
+		if (result) {
+			as_destroy(as);
+			return result;
+		}
+		frame_unpin(frame);
+	}
+
+	*ret = as;
+	return 0;
+}
+
+static
+int
+exitbench_run(const char *name, unsigned stride)
+{
+	struct addrspace *as, *copy;
+	struct timespec start;
+	uint64_t copyns, exitns;
+	unsigned i;
+	int result;
+
+	copyns = exitns = 0;
+	for (i=0; i<EXITBENCH_ROUNDS; i++) {
+		result = exitbench_build(stride, &as);
+		if (result) {
+			return result;
+		}
+
+		gettime(&start);
+		result = as_copy(as, &copy);
+		copyns += vmbench_nsecs(&start);
+		if (result) {
+			as_destroy(as);
+			return result;
+		}
+
+		gettime(&start);
+		as_destroy(copy);
+		as_destroy(as);
+		exitns += vmbench_nsecs(&start);
+	}
+
+	kprintf("vmexitbench: %s (%u of %u pages resident): "
+		"fork %llu ns, exit %llu ns\n", name, EXITBENCH_PAGES,
+		EXITBENCH_PAGES * stride, copyns / EXITBENCH_ROUNDS,
+		exitns / (2 * EXITBENCH_ROUNDS));
+	return 0;
+}
+
+int
+vmexitbench(int nargs, char **args)
+{
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting address space teardown benchmark...\n");
+
+	result = exitbench_run("dense", 1);
+	if (result == 0) {
+		result = exitbench_run("sparse", EXITBENCH_SPARSE);
+	}
+	if (result) {
+		kprintf("vmexitbench: %s\n", strerror(result));
+		return result;
+	}
+
+	kprintf("vmexitbench: done\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// vm3
+
+/*
+ * Compare page table backends (see pagetable.h): fill PTBENCH_SPACES
+ * address spaces with pages scattered over a large region, then time
+ * looking every page up as a TLB refill does, and looking up pages
+ * that have no entry, and print the backend's own statistics (chain
+ * lengths and memory used). Build the kernel with each backend in
+ * turn to compare them. An optional argument sets the number of pages
+ * in each address space.
+ */
+
+#define PTBENCH_SPACES  8
+#define PTBENCH_PAGES   256	/* resident pages in each address space */
+#define PTBENCH_REGION  4096	/* pages in each address space's region */
+#define PTBENCH_ROUNDS  16
+
+/* The i'th resident page; odd multiples of a prime, so none repeat */
+static
+vaddr_t
+ptbench_page(unsigned i)
+{
+	return VMBENCH_BASE + ((2 * i + 1) * 37 % PTBENCH_REGION) * PAGE_SIZE;
+}
+
+/* Time NPAGES lookups in each address space; MISS looks up even pages */
+static
+uint64_t
+ptbench_lookups(struct addrspace **spaces, unsigned npages, bool miss)
+{
+	struct timespec start;
+	struct pte *entry;
+	vaddr_t page;
+	unsigned round, i, j;
+	uint64_t ns;
+
+	ns = 0;
+	for (round=0; round<PTBENCH_ROUNDS; round++) {
+		for (i=0; i<PTBENCH_SPACES; i++) {
+			gettime(&start);
+			for (j=0; j<npages; j++) {
+				page = ptbench_page(j) - (miss ? PAGE_SIZE : 0);
+				hpt_lock(spaces[i], page);
+				entry = hpt_get(spaces[i], page);
+				hpt_unlock(spaces[i], page);
+				KASSERT((entry == NULL) == miss);
+			}
+			ns += vmbench_nsecs(&start);
+		}
+	}
+	return ns / (PTBENCH_ROUNDS * PTBENCH_SPACES * npages);
+}
+
+int
+ptbench(int nargs, char **args)
+{
+	struct addrspace *spaces[PTBENCH_SPACES];
+	vaddr_t frame;
+	unsigned npages, i, j;
+	int result;
+
+	npages = PTBENCH_PAGES;
+	if (nargs == 2) {
+		npages = atoi(args[1]);
+	}
+	if (nargs > 2 || npages == 0 || npages > PTBENCH_REGION / 2) {
+		kprintf("Usage: vm3 [npages]\n");
+		return EINVAL;
+	}
+
+	kprintf("Starting page table benchmark...\n");
+
+	result = 0;
+	for (i=0; i<PTBENCH_SPACES; i++) {
+		spaces[i] = as_create();
+		if (spaces[i] == NULL) {
+			result = ENOMEM;
+			break;
+		}
+		result = as_define_region(spaces[i], VMBENCH_BASE,
+					  PTBENCH_REGION * PAGE_SIZE, 1, 1, 0);
+		for (j=0; j<npages && result == 0; j++) {
+			result = hpt_add(spaces[i], ptbench_page(j),
+					 READ | WRITE, &frame);
+			if (result == 0) {
+				frame_unpin(frame);
+			}
+		}
+		if (result) {
+			as_destroy(spaces[i]);
+			break;
+		}
+	}
+
+	if (result == 0) {
+		kprintf("ptbench: %u address spaces of %u pages: "
+			"lookup %llu ns, miss %llu ns\n",
+			PTBENCH_SPACES, npages,
+			ptbench_lookups(spaces, npages, false),
+			ptbench_lookups(spaces, npages, true));
+		hpt_printstats();
+	}
+
+	while (i > 0) {
+		as_destroy(spaces[--i]);
+	}
+	if (result) {
+		kprintf("ptbench: %s\n", strerror(result));
+		return result;
+	}
+
+	kprintf("ptbench: done\n");
+	return 0;
+}
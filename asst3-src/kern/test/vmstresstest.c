@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * VM stress test.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/wait.h>
+#include <lib.h>
+#include <thread.h>
+#include <proc.h>
+#include <pid.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <vm.h>
+#include <test.h>
+
+////////////////////////////////////////////////////////////
+// vm1
+
+/*
+ * Fault on user pages from NTHREADS processes at once. Each process
+ * gets an address space of its own with a single region of NPAGES
+ * pages, and makes NPASSES over it from the kernel with copyout() and
+ * copyin(), so every first touch of a page goes through vm_fault()
+ * just as it would for a user program. Each pass also copies the
+ * address space, as fork does, so that the next pass has to break
+ * copy-on-write sharing on every page, and then checks that the copy
+ * still holds what was there before.
+ *
+ * With more than one CPU configured in sys161.conf the processes
+ * fault in parallel. An optional argument sets the number of pages;
+ * making it large enough to overcommit memory brings the pager in
+ * too.
+ */
+
+#define NTHREADS  8
+#define NPASSES   4
+#define NPAGES    64
+
+#define VMSTRESS_BASE  0x10000000
+
+/* The word written to the given page in the given pass */
+static
+uint32_t
+vmstress_pattern(unsigned long num, unsigned pass, unsigned page)
+{
+	return (num << 24) ^ (pass << 16) ^ page ^ 0xa5a5a5a5;
+}
+
+/* Where in the page the word goes; different threads use different words */
+static
+userptr_t
+vmstress_addr(unsigned long num, unsigned page)
+{
+	return (userptr_t)(VMSTRESS_BASE + page * PAGE_SIZE +
+			   (num * sizeof(uint32_t)) % PAGE_SIZE);
+}
+
+/*
+ * Check that every page of the current address space holds the words
+ * written in the given pass.
+ */
+static
+int
+vmstress_check(unsigned long num, unsigned pass, unsigned npages)
+{
+	uint32_t word;
+	unsigned page;
+	int result;
+
+	for (page=0; page<npages; page++) {
+		result = copyin(vmstress_addr(num, page), &word, sizeof(word));
+		if (result) {
+			kprintf("vmstress: thread %lu: copyin failed: %s\n",
+				num, strerror(result));
+			return result;
+		}
+		if (word != vmstress_pattern(num, pass, page)) {
+			kprintf("vmstress: thread %lu: pass %u page %u: "
+				"expected 0x%x, found 0x%x\n", num, pass,
+				page, vmstress_pattern(num, pass, page), word);
+			return EINVAL;
+		}
+	}
+	return 0;
+}
+
+static
+int
+vmstress_run(unsigned long num, unsigned npages)
+{
+	struct addrspace *as, *copy;
+	uint32_t word;
+	unsigned pass, page;
+	int result;
+
+	as = as_create();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+	result = as_define_region(as, VMSTRESS_BASE, npages * PAGE_SIZE,
+				  1, 1, 0);
+	if (result) {
+		as_destroy(as);
+		return result;
+	}
+	proc_setas(as);
+	as_activate();
+
+	for (pass=0; pass<NPASSES; pass++) {
+		for (page=0; page<npages; page++) {
+			word = vmstress_pattern(num, pass, page);
+			result = copyout(&word, vmstress_addr(num, page),
+					 sizeof(word));
+			if (result) {
+				kprintf("vmstress: thread %lu: "
+					"copyout failed: %s\n",
+					num, strerror(result));
+				return result;
+			}
+		}
+		result = vmstress_check(num, pass, npages);
+		if (result) {
+			return result;
+		}
+		if (pass == 0) {
+			continue;
+		}
+
+		/*
+		 * Share this pass's pages with a copy, overwrite them
+		 * with the next pass's in the original, and make sure
+		 * the copy was not affected.
+		 */
+		result = as_copy(as, &copy);
+		if (result) {
+			return result;
+		}
+		for (page=0; page<npages; page++) {
+			word = vmstress_pattern(num, pass - 1, page);
+			result = copyout(&word, vmstress_addr(num, page),
+					 sizeof(word));
+			if (result) {
+				as_destroy(copy);
+				return result;
+			}
+		}
+		proc_setas(copy);
+		as_activate();
+		result = vmstress_check(num, pass, npages);
+		proc_setas(as);
+		as_activate();
+		as_destroy(copy);
+		if (result) {
+			return result;
+		}
+		result = vmstress_check(num, pass - 1, npages);
+		if (result) {
+			return result;
+		}
+	}
+
+	/* proc_exit() disposes of the address space */
+	return 0;
+}
+
+static
+void
+vmstressthread(void *np, unsigned long num)
+{
+	unsigned *npages = np;
+	int result;
+
+	result = vmstress_run(num, *npages);
+	proc_exit(_MKWAIT_EXIT(result ? 1 : 0));
+}
+
+int
+vmstress(int nargs, char **args)
+{
+	struct proc *proc;
+	pid_t pids[NTHREADS];
+	unsigned npages;
+	int i, result, status, failures;
+
+	npages = NPAGES;
+	if (nargs == 2) {
+		npages = atoi(args[1]);
+	}
+	if (nargs > 2 || npages == 0) {
+		kprintf("Usage: vm1 [npages]\n");
+		return EINVAL;
+	}
+
+	kprintf("Starting VM stress test...\n");
+
+	for (i=0; i<NTHREADS; i++) {
+		result = proc_create_runprogram("vmstress", &proc);
+		if (result) {
+			panic("vmstress: proc_create_runprogram failed: %s\n",
+			      strerror(result));
+		}
+		pids[i] = proc->p_pid;
+		result = thread_fork("vmstress", proc,
+				     vmstressthread, &npages, i);
+		if (result) {
+			panic("vmstress: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	failures = 0;
+	for (i=0; i<NTHREADS; i++) {
+		pid_wait(pids[i], &status, 0, NULL);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			failures++;
+		}
+	}
+
+	if (failures) {
+		kprintf("VM stress test: %d of %d threads FAILED\n",
+			failures, NTHREADS);
+		return EINVAL;
+	}
+	kprintf("VM stress test done\n");
+	return 0;
+}
@@ -53,6 +53,7 @@
 #include <mainbus.h>
 #include <vnode.h>
 #include <pid.h>
+#include <clock.h>
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -111,6 +112,47 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+/*
+ * Scheduling quantum at each priority, and how often everything is
+ * moved back up to the top. See schedule() below.
+ */
+#define THREAD_QUANTUM(prio)		(1U << (prio))	/* hardclocks */
+#define SCHEDULE_BOOST_HARDCLOCKS	HZ		/* once a second */
+
+/*
+ * Initialize the fields of a thread that is new or being reused from
+ * the pool, apart from its name and stack.
+ */
+static
+void
+thread_init(struct thread *thread)
+{
+	thread->t_wchan_name = "NEW";
+	thread->t_state = S_READY;
+
+	/* Thread subsystem fields */
+	thread_machdep_init(&thread->t_machdep);
+	threadlistnode_init(&thread->t_listnode, thread);
+	thread->t_context = NULL;
+	thread->t_cpu = NULL;
+	thread->t_proc = NULL;
+	HANGMAN_ACTORINIT(&thread->t_hangman, thread->t_name);
+
+	/* Interrupt state fields */
+	thread->t_in_interrupt = false;
+	thread->t_curspl = IPL_HIGH;
+	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
+
+	/* Scheduler fields; new threads start at the top */
+	thread->t_priority = 0;
+	thread->t_quantum = THREAD_QUANTUM(0);
+	thread->t_background = false;
+
+	thread->t_usersp = 0;
+
+	/* If you add to struct thread, be sure to initialize here */
+}
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
@@ -133,24 +175,8 @@ thread_create(const char *name)
 		kfree(thread);
 		return NULL;
 	}
-	thread->t_wchan_name = "NEW";
-	thread->t_state = S_READY;
-
-	/* Thread subsystem fields */
-	thread_machdep_init(&thread->t_machdep);
-	threadlistnode_init(&thread->t_listnode, thread);
 	thread->t_stack = NULL;
-	thread->t_context = NULL;
-	thread->t_cpu = NULL;
-	thread->t_proc = NULL;
-	HANGMAN_ACTORINIT(&thread->t_hangman, thread->t_name);
-
-	/* Interrupt state fields */
-	thread->t_in_interrupt = false;
-	thread->t_curspl = IPL_HIGH;
-	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
-
-	/* If you add to struct thread, be sure to initialize here */
+	thread_init(thread);
 
 	return thread;
 }
@@ -169,6 +195,7 @@ cpu_create(unsigned hardware_number)
 	struct cpu *c;
 	int result;
 	char namebuf[16];
+	unsigned i;
 
 	c = kmalloc(sizeof(*c));
 	if (c == NULL) {
@@ -182,6 +209,16 @@ cpu_create(unsigned hardware_number)
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	c->c_numframes = 0;
+	spinlock_init(&c->c_frames_lock);
+	for (i=0; i<CPU_KMALLOC_SIZES; i++) {
+		c->c_kmalloc_blocks[i] = NULL;
+		c->c_kmalloc_nblocks[i] = 0;
+	}
+	spinlock_init(&c->c_kmalloc_lock);
+	threadlist_init(&c->c_threadpool);
+	c->c_threadpool_hits = 0;
+	c->c_threadpool_misses = 0;
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
@@ -255,6 +292,15 @@ cpu_create(unsigned hardware_number)
 	return c;
 }
 
+struct cpu *
+cpu_lookup(unsigned number)
+{
+	if (number >= cpuarray_num(&allcpus)) {
+		return NULL;
+	}
+	return cpuarray_get(&allcpus, number);
+}
+
 /*
  * Destroy a thread.
  *
@@ -290,9 +336,115 @@ thread_destroy(struct thread *thread)
 	kfree(thread);
 }
 
+/*
+ * Thread pool.
+ *
+ * Rather than destroying exited threads, exorcise() keeps up to
+ * CPU_THREADS of them per cpu with their stacks and names, and
+ * thread_fork takes them back from there instead of allocating a
+ * thread and a stack. A fork-heavy workload otherwise spends much
+ * of its time in kmalloc and kfree for these. Like the zombie list,
+ * the pool is per-cpu and only touched with interrupts off.
+ */
+
+/*
+ * Put an exited thread in this cpu's pool if there is room. Threads
+ * without a stack of their own (the boot threads) are not pooled.
+ * Returns false if the thread should be destroyed instead.
+ */
+static
+bool
+thread_pool_put(struct thread *thread)
+{
+	KASSERT(curthread->t_curspl > 0);
+	KASSERT(thread->t_proc == NULL);
+
+	if (thread->t_stack == NULL ||
+	    curcpu->c_threadpool.tl_count >= CPU_THREADS) {
+		return false;
+	}
+
+	thread_checkstack(thread);
+	thread_machdep_cleanup(&thread->t_machdep);
+	thread->t_wchan_name = "POOLED";
+	threadlist_addhead(&curcpu->c_threadpool, thread);
+	return true;
+}
+
+/*
+ * Take a thread, with its stack, from this cpu's pool and set it up
+ * as if freshly created with the given name. The old name buffer is
+ * reused if the new name fits in it. Returns NULL if the pool is
+ * empty or the name cannot be allocated.
+ */
+static
+struct thread *
+thread_pool_get(const char *name)
+{
+	struct thread *thread;
+	char *newname;
+	int spl;
+
+	spl = splhigh();
+	thread = threadlist_remhead(&curcpu->c_threadpool);
+	if (thread == NULL) {
+		curcpu->c_threadpool_misses++;
+	}
+	else {
+		curcpu->c_threadpool_hits++;
+	}
+	splx(spl);
+
+	if (thread == NULL) {
+		return NULL;
+	}
+
+	if (strlen(name) <= strlen(thread->t_name)) {
+		strcpy(thread->t_name, name);
+	}
+	else {
+		newname = kstrdup(name);
+		if (newname == NULL) {
+			thread_destroy(thread);
+			return NULL;
+		}
+		kfree(thread->t_name);
+		thread->t_name = newname;
+	}
+	thread_init(thread);
+
+	return thread;
+}
+
+/*
+ * Print how often thread_fork has been served from the pool.
+ */
+void
+thread_printpoolstats(void)
+{
+	struct cpu *c;
+	unsigned i, numcpus;
+	unsigned pooled = 0, hits = 0, misses = 0, total;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		pooled += c->c_threadpool.tl_count;
+		hits += c->c_threadpool_hits;
+		misses += c->c_threadpool_misses;
+	}
+	total = hits + misses;
+
+	kprintf("thread pool: %u threads pooled on %u cpus, at most %u each\n",
+		pooled, numcpus, CPU_THREADS);
+	kprintf("thread pool: %u of %u forks reused a thread (%u%%)\n",
+		hits, total, total ? hits * 100 / total : 0);
+}
+
 /*
  * Clean up zombies. (Zombies are threads that have exited but still
- * need to have thread_destroy called on them.)
+ * need to have thread_destroy called on them.) Some are kept in the
+ * thread pool instead.
  *
  * The list of zombies is per-cpu.
  */
@@ -305,7 +457,9 @@ exorcise(void)
 	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
 		KASSERT(z != curthread);
 		KASSERT(z->t_state == S_ZOMBIE);
-		thread_destroy(z);
+		if (!thread_pool_put(z)) {
+			thread_destroy(z);
+		}
 	}
 }
 
@@ -445,6 +599,29 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Put a thread on a cpu's run queue behind those of the same or higher
+ * priority, so the queue is kept in priority order and threads of the
+ * same priority take turns. Most threads are inserted at or near the
+ * tail, so search from there. The caller holds the run queue lock.
+ */
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+	struct thread *other;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	THREADLIST_FORALL_REV(other, c->c_runqueue) {
+		if (other->t_priority <= t->t_priority) {
+			threadlist_insertafter(&c->c_runqueue, other, t);
+			return;
+		}
+	}
+	threadlist_addhead(&c->c_runqueue, t);
+}
+
 /*
  * Make a thread runnable.
  *
@@ -469,7 +646,7 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 
 	/* Target thread is now ready to run; put it on the run queue. */
 	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	runqueue_add(targetcpu, target);
 
 	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
 		/*
@@ -503,16 +680,20 @@ thread_fork(const char *name,
 	struct thread *newthread;
 	int result;
 
-	newthread = thread_create(name);
+	/* Reuse an exited thread and its stack if there is one */
+	newthread = thread_pool_get(name);
 	if (newthread == NULL) {
-		return ENOMEM;
-	}
+		newthread = thread_create(name);
+		if (newthread == NULL) {
+			return ENOMEM;
+		}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+		/* Allocate a stack */
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
 	}
 	thread_checkstack_init(newthread);
 
@@ -605,6 +786,15 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		thread_make_runnable(cur, true /*have lock*/);
 		break;
 	    case S_SLEEP:
+		/*
+		 * Giving up the cpu to wait earns a move up, with a
+		 * fresh quantum for when it wakes.
+		 */
+		if (cur->t_priority > 0 && !cur->t_background) {
+			cur->t_priority--;
+		}
+		cur->t_quantum = THREAD_QUANTUM(cur->t_priority);
+
 		cur->t_wchan_name = wc->wc_name;
 		/*
 		 * Add the thread to the list in the wait channel, and
@@ -807,6 +997,34 @@ thread_exit(void)
 	panic("braaaaaaaiiiiiiiiiiinssssss\n");
 }
 
+/*
+ * Check whether anything else is ready to run on this cpu. The answer
+ * may be out of date by the time it is used; it is only a hint.
+ */
+bool
+thread_cpu_busy(void)
+{
+	bool busy;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	busy = !threadlist_isempty(&curcpu->c_runqueue);
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	return busy;
+}
+
+void
+thread_set_background(void)
+{
+	int spl;
+
+	spl = splhigh();
+	curthread->t_background = true;
+	curthread->t_priority = THREAD_PRIORITIES - 1;
+	curthread->t_quantum = THREAD_QUANTUM(THREAD_PRIORITIES - 1);
+	splx(spl);
+}
+
 /*
  * Yield the cpu to another process, but stay runnable.
  */
@@ -821,17 +1039,106 @@ thread_yield(void)
 /*
  * Scheduler.
  *
+ * Each cpu's run queue is a multi-level feedback queue, kept as one
+ * list in priority order (see runqueue_add). A thread at priority P
+ * runs for up to THREAD_QUANTUM(P) hardclocks at a time; one that uses
+ * up its whole quantum is demoted a level, and one that goes to sleep
+ * is promoted a level. So threads that mostly wait, like the shell or
+ * anything interactive, stay near the top and get the cpu soon after
+ * they wake up, while cpu-bound threads sink to the bottom, where they
+ * run for longer at a stretch. A running thread is preempted at the
+ * next hardclock if a thread of higher priority is ready.
+ *
+ * So that threads at the bottom are not starved by a steady supply of
+ * ones above them, schedule() moves every thread back to the top once
+ * every SCHEDULE_BOOST_HARDCLOCKS. Background threads, which should
+ * only run when the cpu would otherwise be idle, are exempt from both
+ * promotion and boosts (see thread_set_background).
+ */
+void
+thread_tick(void)
+{
+	struct thread *cur, *next;
+	bool preempt;
+
+	cur = curthread;
+
+	/* Time spent idle isn't charged to anyone. */
+	if (curcpu->c_isidle) {
+		return;
+	}
+
+	KASSERT(cur->t_quantum > 0);
+	cur->t_quantum--;
+	if (cur->t_quantum == 0) {
+		if (cur->t_priority < THREAD_PRIORITIES - 1) {
+			cur->t_priority++;
+		}
+		cur->t_quantum = THREAD_QUANTUM(cur->t_priority);
+		thread_yield();
+		return;
+	}
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	next = threadlist_peekhead(&curcpu->c_runqueue);
+	preempt = next != NULL && next->t_priority < cur->t_priority;
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	if (preempt) {
+		thread_yield();
+	}
+}
+
+/*
  * This is called periodically from hardclock(). It should reshuffle
  * the current CPU's run queue by job priority.
+ *
+ * The queue is always kept in order, so all that's left to do here is
+ * the periodic boost.
  */
-
 void
 schedule(void)
 {
+	struct threadlist background;
+	struct thread *t;
+	unsigned i, n;
+	int spl;
+
+	if ((curcpu->c_hardclocks % SCHEDULE_BOOST_HARDCLOCKS) != 0) {
+		return;
+	}
+
+	threadlist_init(&background);
+
 	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
+	 * Background threads stay where they are, so take them out and
+	 * put them back behind everyone else to keep the queue in order.
 	 */
+	spl = splhigh();
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	n = curcpu->c_runqueue.tl_count;
+	for (i = 0; i < n; i++) {
+		t = threadlist_remhead(&curcpu->c_runqueue);
+		if (t->t_background) {
+			threadlist_addtail(&background, t);
+			continue;
+		}
+		t->t_priority = 0;
+		t->t_quantum = THREAD_QUANTUM(0);
+		threadlist_addtail(&curcpu->c_runqueue, t);
+	}
+	while ((t = threadlist_remhead(&background)) != NULL) {
+		threadlist_addtail(&curcpu->c_runqueue, t);
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	threadlist_cleanup(&background);
+
+	if (!curcpu->c_isidle && !curthread->t_background) {
+		curthread->t_priority = 0;
+		curthread->t_quantum = THREAD_QUANTUM(0);
+	}
+	splx(spl);
 }
 
 /*
@@ -923,7 +1230,7 @@ thread_consider_migration(void)
 			}
 
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			runqueue_add(c, t);
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -947,7 +1254,7 @@ thread_consider_migration(void)
 	if (!threadlist_isempty(&victims)) {
 		spinlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+			runqueue_add(curcpu->c_self, t);
 		}
 		spinlock_release(&curcpu->c_runqueue_lock);
 	}
@@ -215,6 +215,15 @@ threadlist_remtail(struct threadlist *tl)
 	return tln->tln_self;
 }
 
+struct thread *
+threadlist_peekhead(struct threadlist *tl)
+{
+	DEBUGASSERT(tl != NULL);
+
+	/* the tail sentinel's tln_self is NULL, so an empty list gives NULL */
+	return tl->tl_head.tln_next->tln_self;
+}
+
 void
 threadlist_insertafter(struct threadlist *tl,
 		       struct thread *onlist, struct thread *addee)
@@ -237,15 +237,15 @@ null_fsync(struct vnode *v)
 }
 
 /*
- * For mmap. If you want this to do anything, you have to write it
- * yourself. Some devices may not make sense to map. Others do.
+ * For mmap. Mapped pages are moved with VOP_READ and VOP_WRITE, which
+ * does not make sense for devices, so none of them can be mapped.
  */
 static
 int
-dev_mmap(struct vnode *v  /* add stuff as needed */)
+dev_mmap(struct vnode *v)
 {
 	(void)v;
-	return ENOSYS;
+	return ENODEV;
 }
 
 /*
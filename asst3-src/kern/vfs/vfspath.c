@@ -38,6 +38,7 @@
 #include <lib.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <textcache.h>
 
 
 /* Does most of the work for open(). */
@@ -98,7 +99,9 @@ vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
 			result = EINVAL;
 		}
 		else {
+			textcache_invalidate(vn);
 			result = VOP_TRUNCATE(vn, 0);
+			textcache_invalidate(vn);
 		}
 		if (result) {
 			VOP_DECREF(vn);
@@ -27,16 +27,24 @@
  * SUCH DAMAGE.
  */
 
+#define ASINLINE
+
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
 #include <spl.h>
 #include <spinlock.h>
 #include <current.h>
+#include <cpu.h>
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <pagetable.h>
+#include <vmstats.h>
 #include <proc.h>
+#include <stat.h>
+#include <vnode.h>
+#include <kmemcache.h>
 
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
@@ -48,18 +56,124 @@
  *
  */
 
+/*
+ * Address space IDs. Each CPU hands out its own: an address space is
+ * given the CPU's next unused ASID the first time it is activated
+ * there in each of the CPU's generations. When all NUM_ASID of them
+ * have been handed out, the CPU flushes its own TLB and begins a new
+ * generation, so TLB entries never outlive the ASID they were tagged
+ * with, the TLB only needs flushing on rollover, and no other CPU is
+ * involved.
+ *
+ * Each CPU's state is only changed by that CPU, with interrupts off.
+ * active is read by other CPUs to tell whether a shootdown has to
+ * interrupt this one; it is set under the address space's tlb_lock.
+ */
+struct asid_cpu {
+	struct cpu *cpu;
+	uint32_t generation;	/* 0 means "no ASID" */
+	uint32_t next;
+	struct addrspace *active;	/* running here, or NULL */
+};
+
+static struct asid_cpu asid_cpus[MAXCPUS];
+
+/*
+ * A CPU sending shootdowns waits here for the targets to acknowledge
+ * them, so that the entries are gone everywhere before the caller goes
+ * on to reuse the frame.
+ */
+struct tlbshootdown_wait {
+	struct spinlock lock;
+	unsigned pending;
+};
+
+/*
+ * Caches of address spaces and regions. A cached address space keeps
+ * its region array and the first chunk of its page list, so a new
+ * process does not grow them again from nothing.
+ */
+#define AS_CACHE_MAX 16
+#define REGION_CACHE_MAX 64
+
+static struct kmem_cache *as_cache;
+static struct kmem_cache *region_cache;
+
+static
+int
+as_ctor(void *obj)
+{
+	struct addrspace *as = obj;
+
+	regionarray_init(&as->regions);
+	as->pages = NULL;
+	as->npages = 0;
+	as->maxpages = 0;
+	as->maxchunks = 0;
+	spinlock_init(&as->tlb_lock);
+	return 0;
+}
+
+static
+void
+as_dtor(void *obj)
+{
+	struct addrspace *as = obj;
+
+	regionarray_cleanup(&as->regions);
+	hpt_pages_destroy(as, false);
+	spinlock_cleanup(&as->tlb_lock);
+}
+
+void
+as_bootstrap(void)
+{
+	as_cache = kmem_cache_create("addrspace", sizeof(struct addrspace),
+				     AS_CACHE_MAX, as_ctor, as_dtor);
+	region_cache = kmem_cache_create("as_regions",
+					 sizeof(struct as_regions),
+					 REGION_CACHE_MAX, NULL, NULL);
+	if (as_cache == NULL || region_cache == NULL) {
+		panic("as_bootstrap: Out of memory\n");
+	}
+}
+
 struct addrspace *
 as_create(void)
 {
 	struct addrspace *as;
 
-	as = kmalloc(sizeof(struct addrspace));
+	as = kmem_cache_alloc(as_cache);
 	if (as == NULL) {
 		return NULL;
 	}
 
-	// initialised as needed in as_define_region
-	as->regions = 0;
+	// filled in by as_define_region
+	KASSERT(regionarray_num(&as->regions) == 0);
+	as->last_region = NULL;
+
+	// set up by as_complete_load
+	as->heap = NULL;
+	as->heap_break = 0;
+
+	// set up by as_define_stack
+	as->stack = NULL;
+
+	// filled in as pages are faulted in
+	KASSERT(as->npages == 0);
+
+	// assigned by as_activate
+	for (unsigned i = 0; i < MAXCPUS; i++) {
+		as->asid[i] = 0;
+		as->asid_generation[i] = 0;
+	}
+	as->cpus = 0;
+
+	as->pt_data = NULL;
+	if (pagetable->pt_create(as)) {
+		kmem_cache_free(as_cache, as);
+		return NULL;
+	}
 
 	return as;
 }
@@ -71,18 +185,44 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	if (!newas) return ENOMEM;
 
 	// copying over regions to the new address space
-	struct as_regions *region;
-	for (region = old->regions; region != NULL; region = region->next) {
-		int ret = as_define_region(newas, region->base, region->size, region->permissions | READ, region->permissions | WRITE, region->permissions | EXECUTE);
+	unsigned num = regionarray_num(&old->regions);
+	for (unsigned i = 0; i < num; i++) {
+		struct as_regions *region = regionarray_get(&old->regions, i);
+		int ret = as_define_region(newas, region->base, region->size, region->permissions & READ, region->permissions & WRITE, region->permissions & EXECUTE);
 		if (ret) {
 			as_destroy(newas);
 			return ret;
 		}
+
+		// regions are copied in order, so the copy has the same index
+		struct as_regions *copy = regionarray_get(&newas->regions, i);
+		copy->type = region->type;
+		if (region == old->heap) {
+			newas->heap = copy;
+			newas->heap_break = old->heap_break;
+		}
+		if (region == old->stack) {
+			newas->stack = copy;
+		}
+		if (region->vnode != NULL) {
+			VOP_INCREF(region->vnode);
+			copy->vnode = region->vnode;
+			copy->file_offset = region->file_offset;
+			copy->file_vaddr = region->file_vaddr;
+			copy->file_size = region->file_size;
+		}
+		if (region->type == REGION_SHARED) {
+			int ret = hpt_share(region, copy);
+			if (ret) {
+				as_destroy(newas);
+				return ret;
+			}
+		}
 	}
 
-	// copy page table entries
-	for (region = newas->regions; region != NULL; region = region->next) {
-		int ret = hpt_copy(region, old, newas);
+	// share page table entries copy-on-write
+	for (unsigned i = 0; i < num; i++) {
+		int ret = hpt_copy(regionarray_get(&newas->regions, i), old, newas);
 		if (ret) {
 			as_destroy(newas);
 			return ret;
@@ -90,21 +230,46 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	}
 
 	*ret = newas;
-	as_activate();
+	// flush the parent's TLB entries, which may still allow writes to
+	// the now shared frames
+	as_tlb_flush(old);
 	return 0;
 }
 
 void
 as_destroy(struct addrspace *as)
 {
-	struct as_regions *prev = NULL;
-	for (struct as_regions *region = as->regions; region != NULL; region = region->next) {
+	// Retire the ASIDs first: they are not reused before each CPU's next
+	// rollover flush, so any TLB entries left behind can never match
+	// again and hpt_free need not hunt them down page by page. Nothing
+	// runs in the address space any more, so no CPU needs interrupting.
+	spinlock_acquire(&as->tlb_lock);
+	for (unsigned i = 0; i < MAXCPUS; i++) {
+		as->asid_generation[i] = 0;
+	}
+	as->cpus = 0;
+	spinlock_release(&as->tlb_lock);
+
+	unsigned num = regionarray_num(&as->regions);
+	for (unsigned i = 0; i < num; i++) {
+		struct as_regions *region = regionarray_get(&as->regions, i);
+		if (region->type == REGION_SHARED && region->vnode != NULL) {
+			// nobody is left to report a failure to
+			int result = hpt_writeback(as, region);
+			if (result) {
+				kprintf("as_destroy: lost changes to a shared "
+					"mapping: %s\n", strerror(result));
+			}
+		}
 		hpt_free(as, region->base, region->size);
-		if (prev) kfree(prev);
-		prev = region;		
+		hpt_unshare(region);
+		if (region->vnode) VOP_DECREF(region->vnode);
+		kmem_cache_free(region_cache, region);
 	}
-	if (prev) kfree(prev);
-	kfree(as);
+	regionarray_setsize(&as->regions, 0);
+	hpt_pages_destroy(as, true);
+	pagetable->pt_destroy(as);
+	kmem_cache_free(as_cache, as);
 	as_deactivate();
 }
 
@@ -112,36 +277,312 @@ void
 as_activate(void)
 {
 	struct addrspace *as;
+	struct asid_cpu *c;
+	unsigned n;
+	int spl;
+
+	// Disable interrupts on the current processor while the TLB and
+	// the ASID register are changed.
+	spl = splhigh();
+	n = curcpu->c_number;
+	c = &asid_cpus[n];
+	KASSERT(n < MAXCPUS);
+
 	as = proc_getas();
 	if (as == NULL) {
 		/*
 		 * Kernel thread without an address space; leave the
-		 * prior address space in place.
+		 * prior address space in place, but don't count it as
+		 * running here.
 		 */
+		c->active = NULL;
+		splx(spl);
 		return;
 	}
-	
-	// Invalidate all entries in the TLB.
-	int spl = splhigh();
 
-	for (int i = 0; i < NUM_TLB; i++)
-	{
-		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	spinlock_acquire(&as->tlb_lock);
+
+	if (c->generation == 0) {
+		// first activation on this CPU
+		c->cpu = curcpu->c_self;
+		c->generation = 1;
+	}
+	if (as->asid_generation[n] != c->generation) {
+		if (c->next == NUM_ASID) {
+			// Out of ASIDs: start a new generation with an empty TLB.
+			for (int i = 0; i < NUM_TLB; i++)
+			{
+				tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+			}
+			c->generation++;
+			c->next = 0;
+			VMSTAT_INC(vs_tlbflushes);
+		}
+		as->asid[n] = c->next++;
+		as->asid_generation[n] = c->generation;
+		as->cpus |= (uint32_t)1 << n;
 	}
+	c->active = as;
+
+	// Only entries tagged with this ASID match from now on.
+	tlb_setasid(as->asid[n]);
 
-	// Re-enable interrupts on the current processor.
-	splx(spl); 
+	spinlock_release(&as->tlb_lock);
+	splx(spl);
 }
 
 void
 as_deactivate(void)
 {
 	/*
-	 * Write this. For many designs it won't need to actually do
-	 * anything. See proc.c for an explanation of why it (might)
-	 * be needed.
+	 * The TLB entries of the old address space are tagged with its
+	 * ASID and stop matching as soon as another address space is
+	 * activated, so they can stay; as_destroy retires the ASIDs.
+	 * The address space no longer runs here, though, so shootdowns
+	 * for it need not interrupt this CPU.
 	 */
-	as_activate();
+	int spl = splhigh();
+	asid_cpus[curcpu->c_number].active = NULL;
+	splx(spl);
+}
+
+/*
+ * The entryhi for VADDR in AS on the current CPU, where AS must be
+ * active. The caller has interrupts off (e.g. holds a spinlock), so it
+ * stays on this CPU while the entry is used.
+ */
+uint32_t
+as_tlb_entryhi(struct addrspace *as, vaddr_t vaddr)
+{
+	uint32_t asid = as->asid[curcpu->c_number];
+	return (vaddr & TLBHI_VPAGE) | ((asid << TLBHI_PIDSHIFT) & TLBHI_PID);
+}
+
+/*
+ * Invalidate this CPU's TLB entry for ENTRYHI, or with ALL set, every
+ * entry carrying its ASID.
+ */
+static
+void
+as_tlb_invalidate_local(uint32_t entryhi, bool all)
+{
+	uint32_t hi, lo;
+	int i;
+
+	if (!all) {
+		i = tlb_probe(entryhi, 0);
+		if (i >= 0) {
+			tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
+		return;
+	}
+	for (i = 0; i < NUM_TLB; i++) {
+		tlb_read(&hi, &lo, i);
+		if ((lo & TLBLO_VALID) &&
+		    (hi & TLBHI_PID) == (entryhi & TLBHI_PID)) {
+			tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
+	}
+}
+
+/*
+ * Remove AS's TLB entries for VADDR, or with ALL set all of them, from
+ * every CPU that may hold them. Where AS is not running, the entries
+ * are left alone and its ASID on that CPU is retired instead, so they
+ * can never match again; it gets a new one when it next runs there.
+ * CPUs running AS are sent a shootdown, and waited for.
+ */
+static
+void
+as_tlb_shootdown(struct addrspace *as, vaddr_t vaddr, bool all)
+{
+	struct tlbshootdown_wait wait;
+	struct tlbshootdown ts;
+	struct asid_cpu *c;
+	uint32_t cpus, bit;
+	unsigned n, me;
+	bool done;
+	int spl;
+
+	spinlock_init(&wait.lock);
+	wait.pending = 0;
+
+	spl = splhigh();
+	me = curcpu->c_number;
+	spinlock_acquire(&as->tlb_lock);
+
+	cpus = as->cpus;
+	for (n = 0; cpus != 0; n++, cpus >>= 1) {
+		if ((cpus & 1) == 0) {
+			continue;
+		}
+		c = &asid_cpus[n];
+		bit = (uint32_t)1 << n;
+
+		if (as->asid_generation[n] != c->generation) {
+			// rolled over since, so flushed already
+			as->cpus &= ~bit;
+			continue;
+		}
+		if (c->active != as) {
+			as->asid_generation[n] = 0;
+			as->cpus &= ~bit;
+			continue;
+		}
+
+		ts.ts_entryhi = (vaddr & TLBHI_VPAGE) |
+			((as->asid[n] << TLBHI_PIDSHIFT) & TLBHI_PID);
+		ts.ts_all = all;
+		ts.ts_generation = as->asid_generation[n];
+		ts.ts_wait = &wait;
+		if (n == me) {
+			as_tlb_invalidate_local(ts.ts_entryhi, all);
+		}
+		else {
+			spinlock_acquire(&wait.lock);
+			wait.pending++;
+			spinlock_release(&wait.lock);
+			ipi_tlbshootdown(c->cpu, &ts);
+			VMSTAT_INC(vs_shootdowns);
+		}
+	}
+
+	spinlock_release(&as->tlb_lock);
+	splx(spl);
+
+	// The targets may be spinning for a lock with interrupts off, so
+	// waiting while holding one could deadlock.
+	done = false;
+	while (!done) {
+		spinlock_acquire(&wait.lock);
+		done = wait.pending == 0;
+		spinlock_release(&wait.lock);
+		KASSERT(done || curcpu->c_spinlocks == 0);
+	}
+	spinlock_cleanup(&wait.lock);
+}
+
+void
+as_tlb_invalidate(struct addrspace *as, vaddr_t vaddr)
+{
+	as_tlb_shootdown(as, vaddr & PAGE_FRAME, false);
+}
+
+void
+as_tlb_flush(struct addrspace *as)
+{
+	VMSTAT_INC(vs_tlbflushes);
+	as_tlb_shootdown(as, 0, true);
+}
+
+/*
+ * Carry out a shootdown sent by as_tlb_shootdown on another CPU, and
+ * acknowledge it. If this CPU has rolled over its ASIDs since, the
+ * entries were flushed then and the ASID may belong to someone else.
+ */
+void
+as_tlbshootdown(const struct tlbshootdown *ts)
+{
+	int spl = splhigh();
+	if (ts->ts_generation == asid_cpus[curcpu->c_number].generation) {
+		as_tlb_invalidate_local(ts->ts_entryhi, ts->ts_all);
+	}
+	splx(spl);
+
+	spinlock_acquire(&ts->ts_wait->lock);
+	ts->ts_wait->pending--;
+	spinlock_release(&ts->ts_wait->lock);
+}
+
+/*
+ * Return the index of the first region of AS whose base is above
+ * VADDR; the region containing VADDR, if any, is the one before it.
+ */
+static
+unsigned
+as_region_search(struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned lo = 0, hi = regionarray_num(&as->regions);
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+		if (regionarray_get(&as->regions, mid)->base <= vaddr) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/*
+ * Find the region of AS containing VADDR, or NULL if it is not in any
+ * region. Faults tend to come in runs within the same region, so the
+ * last region found is tried before searching.
+ */
+struct as_regions *
+as_find_region(struct addrspace *as, vaddr_t vaddr)
+{
+	struct as_regions *region = as->last_region;
+
+	if (region != NULL && vaddr >= region->base &&
+	    vaddr < region->base + region->size) {
+		return region;
+	}
+
+	unsigned index = as_region_search(as, vaddr);
+	if (index == 0) {
+		return NULL;
+	}
+	region = regionarray_get(&as->regions, index - 1);
+	if (vaddr >= region->base + region->size) {
+		return NULL;
+	}
+
+	as->last_region = region;
+	return region;
+}
+
+/*
+ * Grow the stack down to take in the page of VADDR, which is not in
+ * any region, if the stack may grow that far: to no more than
+ * VM_STACKMAX below USERSTACK, and leaving VM_STACKGUARD pages free
+ * above the region below it (the heap), so running off the end of
+ * either is caught. VADDR must also be above, or at most
+ * VM_STACKSLACK pages below, the user stack pointer SP; a stray
+ * pointer further down is a fault, not a deeper stack. Returns the
+ * stack region, or NULL if VADDR is not a place for the stack.
+ */
+struct as_regions *
+as_grow_stack(struct addrspace *as, vaddr_t vaddr, vaddr_t sp)
+{
+	struct as_regions *stack = as->stack;
+
+	vaddr &= PAGE_FRAME;
+	sp &= PAGE_FRAME;
+	if (stack == NULL || vaddr >= stack->base ||
+	    vaddr < USERSTACK - VM_STACKMAX) {
+		return NULL;
+	}
+	if (sp < VM_STACKSLACK * PAGE_SIZE ||
+	    vaddr < sp - VM_STACKSLACK * PAGE_SIZE) {
+		return NULL;
+	}
+
+	// the stack is the region before the first one based above it
+	unsigned index = as_region_search(as, stack->base) - 1;
+	KASSERT(regionarray_get(&as->regions, index) == stack);
+	if (index > 0) {
+		struct as_regions *below = regionarray_get(&as->regions, index - 1);
+		if (vaddr < below->base + below->size + VM_STACKGUARD * PAGE_SIZE) {
+			return NULL;
+		}
+	}
+
+	stack->size += stack->base - vaddr;
+	stack->base = vaddr;
+	return stack;
 }
 
 /*
@@ -176,17 +617,24 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
         return EFAULT;
     }
 
-	// Check for overlapping regions
-    struct as_regions *curr = as->regions;
-    while (curr != NULL) {
-        if ((vaddr <= curr->base + curr->size) && (vaddr + memsize) >= curr->base) {
+	// Check for overlapping regions; only the neighbours in the sorted
+	// array can overlap
+    unsigned index = as_region_search(as, vaddr);
+    if (index > 0) {
+        struct as_regions *prev = regionarray_get(&as->regions, index - 1);
+        if (prev->base + prev->size > vaddr) {
+            return EINVAL;
+        }
+    }
+    if (index < regionarray_num(&as->regions)) {
+        struct as_regions *next = regionarray_get(&as->regions, index);
+        if (vaddr + memsize > next->base) {
             return EINVAL;
         }
-        curr = curr->next;
     }
 
 	// Initialize the new region
-    struct as_regions *new_region = kmalloc(sizeof(struct as_regions));
+    struct as_regions *new_region = kmem_cache_alloc(region_cache);
     if (new_region == NULL) {
         return ENOMEM;
     }
@@ -194,66 +642,98 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
 	// Set base, size, permissions
 	new_region->base = vaddr;
     new_region->size = memsize;
-    new_region->read_only_change = false;
     new_region->permissions = 0;
+    new_region->type = REGION_SEGMENT;
+    new_region->vnode = NULL;
+    new_region->file_offset = 0;
+    new_region->file_vaddr = 0;
+    new_region->file_size = 0;
+    new_region->share = NULL;
 
 	if (readable) new_region->permissions |= READ;
     if (writeable) new_region->permissions |= WRITE;
     if (executable) new_region->permissions |= EXECUTE;
 
-	new_region->next = as->regions;
-	as->regions = new_region;
+	// Insert it in order, shifting up the regions above it
+    unsigned num = regionarray_num(&as->regions);
+    int result = regionarray_setsize(&as->regions, num + 1);
+    if (result) {
+        kmem_cache_free(region_cache, new_region);
+        return result;
+    }
+    for (unsigned i = num; i > index; i--) {
+        regionarray_set(&as->regions, i, regionarray_get(&as->regions, i - 1));
+    }
+    regionarray_set(&as->regions, index, new_region);
 
 	return 0; 
 }
 
+/*
+ * Attach the file contents backing the region that starts at VADDR:
+ * FILESIZE bytes at file offset OFFSET of V map to VADDR onwards. The
+ * rest of the region is zero-filled. Nothing is read until the pages
+ * are faulted in.
+ */
+int
+as_define_backing(struct addrspace *as, vaddr_t vaddr, struct vnode *v,
+		  off_t offset, size_t filesize)
+{
+	if (as == NULL || v == NULL) {
+		return EINVAL;
+	}
+
+	struct as_regions *region = as_find_region(as, vaddr);
+	if (region == NULL) {
+		return EFAULT;
+	}
+	if (region->vnode != NULL ||
+	    vaddr + filesize > region->base + region->size) {
+		return EINVAL;
+	}
+
+	VOP_INCREF(v);
+	region->vnode = v;
+	region->file_offset = offset;
+	region->file_vaddr = vaddr;
+	region->file_size = filesize;
+	return 0;
+}
+
 int
 as_prepare_load(struct addrspace *as)
 {
 	/*
-	 * Write this.
+	 * Segments are paged in from the executable on demand, straight
+	 * into the frame through its kernel address, so read-only
+	 * regions never need to be made writeable for loading.
 	 */
 
 	if (as == NULL) {
         return EINVAL;
     }
 
-    for (struct as_regions *region = as->regions; region != NULL; region = region->next) {
-		// Check if the region is read-only (READ permissions but not WRITE permission)
-		if ((region->permissions & READ) && !(region->permissions & WRITE)) {
-            // Temporarily make the region writeable
-            region->permissions |= WRITE;
-            // Set the read_only_change flag to true
-            region->read_only_change = true;
-
-			set_page_write_permissions(as, region->base, region->size);
-        }
-    }
-
-	
 	return 0;
 }
 
 int
 as_complete_load(struct addrspace *as)
 {
-	/*
-	 * Write this.
-	 */
-
 	if (as == NULL) return EINVAL;
 
-    for (struct as_regions *region = as->regions; region != NULL; region = region->next) {
-		// Check if the read_only_change flag is true
-		if (region->read_only_change) {
-            // Restore the original write permissions (remove the WRITE permission)
-            region->permissions &= ~WRITE;
-            // Set the read_only_change flag back to false
-            region->read_only_change = false;
-
-			reset_page_write_permissions(as, region->base, region->size);
-        }
-    }
+	// The heap starts out empty, just past the last segment.
+	unsigned num = regionarray_num(&as->regions);
+	vaddr_t heap_base = 0;
+	if (num > 0) {
+		struct as_regions *last = regionarray_get(&as->regions, num - 1);
+		heap_base = last->base + last->size;
+	}
+	int result = as_define_region(as, heap_base, 0, 1, 1, 0);
+	if (result) {
+		return result;
+	}
+	as->heap = regionarray_get(&as->regions, as_region_search(as, heap_base) - 1);
+	as->heap_break = heap_base;
 
 	as_activate();	
 	return 0;
@@ -279,6 +759,7 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	if (define_stack) {
 		return 1;
 	}
+	as->stack = as_find_region(as, stack_base);
 
 	/* Initial user-level stack pointer */
 	*stackptr = USERSTACK;
@@ -286,3 +767,236 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+/*
+ * Move the break (the end of the heap) by AMOUNT bytes and hand back
+ * the old break. Growing only extends the region; the new pages are
+ * zero-filled when first touched. Shrinking frees the pages past the
+ * new end straight away.
+ */
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
+{
+	struct as_regions *heap = as->heap;
+
+	if (heap == NULL) {
+		return ENOMEM;
+	}
+
+	vaddr_t newbreak = as->heap_break + amount;
+	if (amount < 0 && (newbreak > as->heap_break || newbreak < heap->base)) {
+		return EINVAL;
+	}
+	if (amount > 0 && newbreak < as->heap_break) {
+		return ENOMEM;
+	}
+
+	size_t newsize = ROUNDUP(newbreak - heap->base, PAGE_SIZE);
+	if (newsize > heap->size) {
+		// must not run into the next region, or into the guard
+		// below the stack
+		unsigned next = as_region_search(as, heap->base);
+		vaddr_t limit = MIPS_KSEG0;
+		if (next < regionarray_num(&as->regions)) {
+			struct as_regions *above = regionarray_get(&as->regions, next);
+			limit = above->base;
+			if (above == as->stack) {
+				limit -= VM_STACKGUARD * PAGE_SIZE;
+			}
+		}
+		if (newsize > limit - heap->base) {
+			return ENOMEM;
+		}
+	}
+	else if (newsize < heap->size) {
+		hpt_free(as, heap->base + newsize, heap->size - newsize);
+	}
+
+	heap->size = newsize;
+	*oldbreak = as->heap_break;
+	as->heap_break = newbreak;
+	return 0;
+}
+
+/*
+ * Find a place for a new region of SIZE bytes: the top of the highest
+ * gap between regions it fits in, which keeps mappings away from the
+ * space just past the break that the heap grows into. The space the
+ * stack may grow into, and its guard, are left alone too.
+ */
+static
+int
+as_find_gap(struct addrspace *as, size_t size, vaddr_t *ret)
+{
+	const vaddr_t stack_limit =
+		USERSTACK - VM_STACKMAX - VM_STACKGUARD * PAGE_SIZE;
+	unsigned num = regionarray_num(&as->regions);
+	vaddr_t top = USERSTACK;
+
+	for (unsigned i = num; i > 0; i--) {
+		struct as_regions *below = regionarray_get(&as->regions, i - 1);
+		vaddr_t bottom = below->base + below->size;
+
+		if (i < num) {
+			top = regionarray_get(&as->regions, i)->base;
+		}
+		if (top > stack_limit) {
+			top = stack_limit;
+		}
+		if (top > bottom && top - bottom >= size) {
+			*ret = top - size;
+			return 0;
+		}
+	}
+	return ENOMEM;
+}
+
+/*
+ * Look up the mapping made by as_mmap that starts at ADDR, and its
+ * index in the region array.
+ */
+static
+struct as_regions *
+as_find_mapping(struct addrspace *as, vaddr_t addr, unsigned *index)
+{
+	unsigned next = as_region_search(as, addr);
+	if (next == 0) {
+		return NULL;
+	}
+
+	struct as_regions *region = regionarray_get(&as->regions, next - 1);
+	if (region->base != addr || region->type == REGION_SEGMENT) {
+		return NULL;
+	}
+
+	*index = next - 1;
+	return region;
+}
+
+/*
+ * Map LENGTH bytes of the file V, starting at OFFSET, into a new
+ * region of AS with the given permissions. TYPE is REGION_PRIVATE or
+ * REGION_SHARED. The part of the region past the end of the file reads
+ * as zeros and is never written back. With no file (V is NULL) the
+ * region is anonymous memory that starts out zero-filled; a shared one
+ * stays shared with the children the address space is copied into.
+ * Hands back the region's address.
+ */
+int
+as_mmap(struct addrspace *as, size_t length, int permissions, int type,
+	struct vnode *v, off_t offset, vaddr_t *addr)
+{
+	struct stat st;
+	vaddr_t base;
+	int result;
+
+	KASSERT(type == REGION_PRIVATE || type == REGION_SHARED);
+
+	if (length == 0 || offset < 0 || offset % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+	if (length > USERSTACK) {
+		return ENOMEM;
+	}
+	length = ROUNDUP(length, PAGE_SIZE);
+
+	if (v != NULL) {
+		result = VOP_MMAP(v);
+		if (result) {
+			return result;
+		}
+		result = VOP_STAT(v, &st);
+		if (result) {
+			return result;
+		}
+	}
+
+	result = as_find_gap(as, length, &base);
+	if (result) {
+		return result;
+	}
+	result = as_define_region(as, base, length, permissions & READ,
+				  permissions & WRITE, 0);
+	if (result) {
+		return result;
+	}
+
+	struct as_regions *region = as_find_region(as, base);
+	KASSERT(region != NULL && region->base == base);
+
+	region->type = type;
+	if (v == NULL) {
+		*addr = base;
+		return 0;
+	}
+
+	VOP_INCREF(v);
+	region->vnode = v;
+	region->file_offset = offset;
+	region->file_vaddr = base;
+	region->file_size = 0;
+	if (st.st_size > offset) {
+		region->file_size = st.st_size - offset < (off_t)length ?
+			st.st_size - offset : length;
+	}
+
+	*addr = base;
+	return 0;
+}
+
+/*
+ * Remove the mapping that starts at ADDR. Changes to a shared mapping
+ * are written back first; if that fails the mapping stays.
+ */
+int
+as_munmap(struct addrspace *as, vaddr_t addr)
+{
+	unsigned index;
+	int result;
+
+	struct as_regions *region = as_find_mapping(as, addr, &index);
+	if (region == NULL) {
+		return EINVAL;
+	}
+
+	if (region->type == REGION_SHARED && region->vnode != NULL) {
+		result = hpt_writeback(as, region);
+		if (result) {
+			return result;
+		}
+	}
+
+	// frames still mapped by other processes sharing the region
+	// are freed by the last of them
+	hpt_free(as, region->base, region->size);
+	hpt_unshare(region);
+	if (region->vnode != NULL) {
+		VOP_DECREF(region->vnode);
+	}
+
+	regionarray_remove(&as->regions, index);
+	if (as->last_region == region) {
+		as->last_region = NULL;
+	}
+	kmem_cache_free(region_cache, region);
+	return 0;
+}
+
+/*
+ * Write the changes to the mapping that starts at ADDR back to its
+ * file. Private and anonymous mappings have nothing to write.
+ */
+int
+as_msync(struct addrspace *as, vaddr_t addr)
+{
+	unsigned index;
+
+	struct as_regions *region = as_find_mapping(as, addr, &index);
+	if (region == NULL) {
+		return EINVAL;
+	}
+
+	if (region->type != REGION_SHARED || region->vnode == NULL) {
+		return 0;
+	}
+	return hpt_writeback(as, region);
+}
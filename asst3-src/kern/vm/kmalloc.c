@@ -29,7 +29,10 @@
 
 #include <types.h>
 #include <lib.h>
+#include <spl.h>
 #include <spinlock.h>
+#include <current.h>
+#include <cpu.h>
 #include <vm.h>
 
 /*
@@ -160,10 +163,9 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * One spinlock covers the heap pages and their pagerefs. Most
+ * allocations and frees do not take it, though: each cpu caches free
+ * blocks in front of the pages (see "Per-cpu caches" below).
  */
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
@@ -212,6 +214,16 @@ struct kheap_root {
 
 static struct kheap_root kheaproots[NUM_PAGEREFPAGES];
 
+/*
+ * The pageref of each heap page, indexed by physical page number, so
+ * that kfree can find a block's page without searching. The same 16M
+ * limit applies.
+ */
+
+#define KHEAP_MAXPAGES (16*1024*1024 / PAGE_SIZE)
+
+static struct pageref *pagerefmap[KHEAP_MAXPAGES];
+
 /*
  * Allocate a page to hold pagerefs.
  */
@@ -867,110 +879,52 @@ int blocktype(size_t clientsz)
 }
 
 /*
- * Allocate a block of size SZ, where SZ is not large enough to
- * warrant a whole-page allocation.
+ * Find the pageref of the heap page holding ADDR, or NULL if ADDR is
+ * not on a heap page. A page only joins or leaves the heap while none
+ * of its blocks are allocated, so the entry for an allocated block's
+ * page can be read without the lock.
  */
 static
-void *
-subpage_kmalloc(size_t sz
-#ifdef LABELS
-		, vaddr_t label
-#endif
-	)
+struct pageref *
+subpage_lookup(vaddr_t addr)
 {
-	unsigned blktype;	// index into sizes[] that we're using
-	struct pageref *pr;	// pageref for page we're allocating from
+	paddr_t pagenum;
+
+	/* pointers outside kseg0 wrap around to huge page numbers */
+	pagenum = KVADDR_TO_PADDR(addr) / PAGE_SIZE;
+	if (pagenum >= KHEAP_MAXPAGES) {
+		return NULL;
+	}
+	return pagerefmap[pagenum];
+}
+
+/*
+ * Add a fresh page of blocks of type BLKTYPE to the heap. Called with
+ * kmalloc_spinlock held and returns with it held, but releases it to
+ * call alloc_kpages. This avoids deadlock if alloc_kpages needs to
+ * come back here. Note that this means things can change behind the
+ * caller's back...
+ */
+static
+struct pageref *
+subpage_newpage(unsigned blktype)
+{
+	struct pageref *pr;	// pageref for the new page
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
 	vaddr_t fla;		// free list entry address
 	struct freelist *volatile fl;	// free list entry
-	void *retptr;		// our result
 
 	volatile int i;
 
-#ifdef GUARDS
-	size_t clientsz;
-#endif
-
-#ifdef GUARDS
-	clientsz = sz;
-	sz += GUARD_OVERHEAD;
-#endif
-#ifdef LABELS
-#ifdef GUARDS
-	/* Include the label in what GUARDS considers the client data. */
-	clientsz += LABEL_PTROFFSET;
-#endif
-	sz += LABEL_PTROFFSET;
-#endif
-	blktype = blocktype(sz);
-#ifdef GUARDS
-	sz = sizes[blktype];
-#endif
-
-	spinlock_acquire(&kmalloc_spinlock);
-
-	checksubpages();
-
-	for (pr = sizebases[blktype]; pr != NULL; pr = pr->next_samesize) {
-
-		/* check for corruption */
-		KASSERT(PR_BLOCKTYPE(pr) == blktype);
-		checksubpage(pr);
-
-		if (pr->nfree > 0) {
-
-		doalloc: /* comes here after getting a whole fresh page */
-
-			KASSERT(pr->freelist_offset < PAGE_SIZE);
-			prpage = PR_PAGEADDR(pr);
-			fla = prpage + pr->freelist_offset;
-			fl = (struct freelist *)fla;
-
-			retptr = fl;
-			fl = fl->next;
-			pr->nfree--;
-
-			if (fl != NULL) {
-				KASSERT(pr->nfree > 0);
-				fla = (vaddr_t)fl;
-				KASSERT(fla - prpage < PAGE_SIZE);
-				pr->freelist_offset = fla - prpage;
-			}
-			else {
-				KASSERT(pr->nfree == 0);
-				pr->freelist_offset = INVALID_OFFSET;
-			}
-#ifdef GUARDS
-			retptr = establishguardband(retptr, clientsz, sz);
-#endif
-#ifdef LABELS
-			retptr = establishlabel(retptr, label);
-#endif
-
-			checksubpages();
-
-			spinlock_release(&kmalloc_spinlock);
-			return retptr;
-		}
-	}
-
-	/*
-	 * No page of the right size available.
-	 * Make a new one.
-	 *
-	 * We release the spinlock while calling alloc_kpages. This
-	 * avoids deadlock if alloc_kpages needs to come back here.
-	 * Note that this means things can change behind our back...
-	 */
-
 	spinlock_release(&kmalloc_spinlock);
 	prpage = alloc_kpages(1);
 	if (prpage==0) {
 		/* Out of memory. */
-		kprintf("kmalloc: Subpage allocator couldn't get a page\n");
+		spinlock_acquire(&kmalloc_spinlock);
 		return NULL;
 	}
 	KASSERT(prpage % PAGE_SIZE == 0);
+	KASSERT(KVADDR_TO_PADDR(prpage) / PAGE_SIZE < KHEAP_MAXPAGES);
 #ifdef CHECKBEEF
 	/* deadbeef the whole page, as it probably starts zeroed */
 	fill_deadbeef((void *)prpage, PAGE_SIZE);
@@ -983,6 +937,7 @@ subpage_kmalloc(size_t sz
 		spinlock_release(&kmalloc_spinlock);
 		free_kpages(prpage);
 		kprintf("kmalloc: Subpage allocator couldn't get pageref\n");
+		spinlock_acquire(&kmalloc_spinlock);
 		return NULL;
 	}
 
@@ -1013,8 +968,414 @@ subpage_kmalloc(size_t sz
 	pr->next_all = allbase;
 	allbase = pr;
 
-	/* This is kind of cheesy, but avoids duplicating the alloc code. */
-	goto doalloc;
+	pagerefmap[KVADDR_TO_PADDR(prpage) / PAGE_SIZE] = pr;
+
+	return pr;
+}
+
+/*
+ * Move up to N free blocks off the page PR onto the front of *LIST.
+ * Returns how many were moved.
+ */
+static
+unsigned
+subpage_takefrom(struct pageref *pr, struct freelist **list, unsigned n)
+{
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *fl;	// free list entry
+	unsigned taken;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	prpage = PR_PAGEADDR(pr);
+	for (taken = 0; taken < n && pr->nfree > 0; taken++) {
+		KASSERT(pr->freelist_offset < PAGE_SIZE);
+		fla = prpage + pr->freelist_offset;
+		fl = (struct freelist *)fla;
+
+		pr->nfree--;
+		if (fl->next != NULL) {
+			KASSERT(pr->nfree > 0);
+			fla = (vaddr_t)fl->next;
+			KASSERT(fla - prpage < PAGE_SIZE);
+			pr->freelist_offset = fla - prpage;
+		}
+		else {
+			KASSERT(pr->nfree == 0);
+			pr->freelist_offset = INVALID_OFFSET;
+		}
+
+		fl->next = *list;
+		*list = fl;
+	}
+	return taken;
+}
+
+/*
+ * Take up to N free blocks of type BLKTYPE off the heap pages and chain
+ * them onto *LIST, starting a new page if there are none. Returns how
+ * many were taken, which is 0 only when out of memory.
+ */
+static
+unsigned
+subpage_take(unsigned blktype, struct freelist **list, unsigned n)
+{
+	struct pageref *pr;	// pageref for page we're allocating from
+	unsigned taken = 0;
+
+	spinlock_acquire(&kmalloc_spinlock);
+
+	checksubpages();
+
+	for (pr = sizebases[blktype]; pr != NULL && taken < n;
+	     pr = pr->next_samesize) {
+
+		/* check for corruption */
+		KASSERT(PR_BLOCKTYPE(pr) == blktype);
+		checksubpage(pr);
+
+		taken += subpage_takefrom(pr, list, n - taken);
+	}
+
+	if (taken == 0) {
+		/* No page of the right size available. Make a new one. */
+		pr = subpage_newpage(blktype);
+		if (pr != NULL) {
+			taken = subpage_takefrom(pr, list, n);
+		}
+	}
+
+	checksubpages();
+
+	spinlock_release(&kmalloc_spinlock);
+	return taken;
+}
+
+/*
+ * Return the free blocks chained on LIST to their pages, and release
+ * the pages that are left with no blocks allocated.
+ */
+static
+void
+subpage_give(struct freelist *list)
+{
+	int blktype;		// index into sizes[] of the block's page
+	struct pageref *pr;	// pageref for page we're freeing in
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t offset;		// offset into page
+	struct freelist *fl, *next;
+	struct freelist *freepages = NULL;	// pages to release
+
+	spinlock_acquire(&kmalloc_spinlock);
+
+	checksubpages();
+
+	for (fl = list; fl != NULL; fl = next) {
+		next = fl->next;
+
+		pr = subpage_lookup((vaddr_t)fl);
+		KASSERT(pr != NULL);
+		prpage = PR_PAGEADDR(pr);
+		blktype = PR_BLOCKTYPE(pr);
+
+		/* check for corruption */
+		KASSERT(blktype>=0 && blktype<NSIZES);
+		checksubpage(pr);
+
+		offset = (vaddr_t)fl - prpage;
+		if (pr->freelist_offset == INVALID_OFFSET) {
+			fl->next = NULL;
+		} else {
+			fl->next = (struct freelist *)(prpage + pr->freelist_offset);
+
+			/* this block should not already be on the free list! */
+#ifdef SLOW
+			{
+				struct freelist *fl2;
+
+				for (fl2 = fl->next; fl2 != NULL; fl2 = fl2->next) {
+					KASSERT(fl2 != fl);
+				}
+			}
+#else
+			/* check just the head */
+			KASSERT(fl != fl->next);
+#endif
+		}
+		pr->freelist_offset = offset;
+		pr->nfree++;
+
+		KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
+		if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
+			/* Whole page is free. */
+			remove_lists(pr, blktype);
+			freepageref(pr);
+			pagerefmap[KVADDR_TO_PADDR(prpage) / PAGE_SIZE] = NULL;
+
+			/* the page is unused now, so it can hold the link */
+			((struct freelist *)prpage)->next = freepages;
+			freepages = (struct freelist *)prpage;
+		}
+	}
+
+	checksubpages();
+
+	spinlock_release(&kmalloc_spinlock);
+
+	/* Call free_kpages without kmalloc_spinlock. */
+	for (fl = freepages; fl != NULL; fl = next) {
+		next = fl->next;
+		free_kpages((vaddr_t)fl);
+	}
+}
+
+////////////////////////////////////////
+
+/*
+ * Per-cpu caches.
+ *
+ * Each cpu keeps a list of free blocks of each size in front of the
+ * heap pages (c_kmalloc_blocks in struct cpu), linked through their
+ * first words like the pages' own free lists. The lists are used by
+ * their own cpu, under its c_kmalloc_lock, which no other cpu takes
+ * unless memory has run out, so allocating from and freeing to them
+ * does not contend. When a list runs dry half a list's worth of
+ * blocks is taken from the pages at once, and when it overflows half
+ * of it is given back, so kmalloc_spinlock is only taken once every
+ * few calls. c_kmalloc_lock is never held while taking it.
+ *
+ * As far as the pages are concerned, cached blocks are allocated, and
+ * a page is only released once all of its blocks come back. So that
+ * not too much memory is held up, a list holds at most two pages'
+ * worth of blocks, and every cpu's lists are given back whenever a new
+ * page cannot be had.
+ *
+ * The heap checks of SLOW and the leak dumps of LABELS look at every
+ * block of every page, and would take cached blocks for allocated
+ * ones; with either on, nothing is cached.
+ */
+
+#if CPU_KMALLOC_SIZES != NSIZES
+#error "CPU_KMALLOC_SIZES in cpu.h does not match NSIZES"
+#endif
+
+#if defined(SLOW) || defined(LABELS)
+static const unsigned cachesizes[NSIZES] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+#else
+static const unsigned cachesizes[NSIZES] = { 64, 64, 32, 32, 16, 8, 8, 4 };
+#endif
+
+/*
+ * Give all of every cpu's cached blocks back to the pages.
+ */
+static
+void
+subpage_drain_all(void)
+{
+	struct freelist *lists[NSIZES];
+	struct cpu *c;
+	unsigned i, n;
+
+	if (!CURCPU_EXISTS()) {
+		return;
+	}
+
+	for (n = 0; (c = cpu_lookup(n)) != NULL; n++) {
+		spinlock_acquire(&c->c_kmalloc_lock);
+		for (i=0; i<NSIZES; i++) {
+			lists[i] = c->c_kmalloc_blocks[i];
+			c->c_kmalloc_blocks[i] = NULL;
+			c->c_kmalloc_nblocks[i] = 0;
+		}
+		spinlock_release(&c->c_kmalloc_lock);
+
+		for (i=0; i<NSIZES; i++) {
+			if (lists[i] != NULL) {
+				subpage_give(lists[i]);
+			}
+		}
+	}
+}
+
+/*
+ * Get a free block of type BLKTYPE, from this cpu's cache if it has
+ * one. Returns NULL if out of memory.
+ */
+static
+void *
+subpage_get(unsigned blktype)
+{
+	struct freelist *list, *fl, *tail;
+	struct cpu *c;
+	unsigned n, batch;
+	int spl;
+
+	batch = cachesizes[blktype] / 2;
+
+	if (batch > 0 && CURCPU_EXISTS()) {
+		spl = splhigh();
+		c = curcpu->c_self;
+		spinlock_acquire(&c->c_kmalloc_lock);
+		fl = c->c_kmalloc_blocks[blktype];
+		if (fl != NULL) {
+			c->c_kmalloc_blocks[blktype] = fl->next;
+			c->c_kmalloc_nblocks[blktype]--;
+		}
+		spinlock_release(&c->c_kmalloc_lock);
+		splx(spl);
+		if (fl != NULL) {
+			return fl;
+		}
+	}
+	else {
+		batch = 1;
+	}
+
+	/* Refill the cache, keeping the first block for ourselves. */
+	list = NULL;
+	n = subpage_take(blktype, &list, batch);
+	if (n == 0) {
+		/* Cached blocks may free a page; give them all back. */
+		subpage_drain_all();
+		n = subpage_take(blktype, &list, 1);
+		if (n == 0) {
+			kprintf("kmalloc: Subpage allocator couldn't get a page\n");
+			return NULL;
+		}
+	}
+
+	fl = list;
+	list = list->next;
+	n--;
+	if (n == 0) {
+		return fl;
+	}
+
+	for (tail = list; tail->next != NULL; tail = tail->next) {
+		/* nothing */
+	}
+
+	/*
+	 * We may have moved to another cpu, or another thread may have
+	 * refilled this one's cache, while the lock was held.
+	 */
+	spl = splhigh();
+	c = curcpu->c_self;
+	spinlock_acquire(&c->c_kmalloc_lock);
+	if (c->c_kmalloc_nblocks[blktype] + n <= cachesizes[blktype]) {
+		tail->next = c->c_kmalloc_blocks[blktype];
+		c->c_kmalloc_blocks[blktype] = list;
+		c->c_kmalloc_nblocks[blktype] += n;
+		list = NULL;
+	}
+	spinlock_release(&c->c_kmalloc_lock);
+	splx(spl);
+
+	if (list != NULL) {
+		subpage_give(list);
+	}
+	return fl;
+}
+
+/*
+ * Put the free block FL of type BLKTYPE in this cpu's cache, giving
+ * the oldest half of the cache back to the pages if it is full.
+ */
+static
+void
+subpage_put(unsigned blktype, struct freelist *fl)
+{
+	struct freelist *list, *keep;
+	struct cpu *c;
+	unsigned i;
+	int spl;
+
+	if (cachesizes[blktype] == 0 || !CURCPU_EXISTS()) {
+		fl->next = NULL;
+		subpage_give(fl);
+		return;
+	}
+
+	list = NULL;
+
+	spl = splhigh();
+	c = curcpu->c_self;
+	spinlock_acquire(&c->c_kmalloc_lock);
+
+	/* this block should not already be cached! check just the head */
+	KASSERT(fl != c->c_kmalloc_blocks[blktype]);
+
+	fl->next = c->c_kmalloc_blocks[blktype];
+	c->c_kmalloc_blocks[blktype] = fl;
+	c->c_kmalloc_nblocks[blktype]++;
+
+	if (c->c_kmalloc_nblocks[blktype] > cachesizes[blktype]) {
+		/* keep the most recently freed blocks, still in the cache */
+		keep = fl;
+		for (i=1; i < cachesizes[blktype] / 2; i++) {
+			keep = keep->next;
+		}
+		list = keep->next;
+		keep->next = NULL;
+		c->c_kmalloc_nblocks[blktype] = cachesizes[blktype] / 2;
+	}
+	spinlock_release(&c->c_kmalloc_lock);
+	splx(spl);
+
+	if (list != NULL) {
+		subpage_give(list);
+	}
+}
+
+/*
+ * Allocate a block of size SZ, where SZ is not large enough to
+ * warrant a whole-page allocation.
+ */
+static
+void *
+subpage_kmalloc(size_t sz
+#ifdef LABELS
+		, vaddr_t label
+#endif
+	)
+{
+	unsigned blktype;	// index into sizes[] that we're using
+	void *retptr;		// our result
+
+#ifdef GUARDS
+	size_t clientsz;
+#endif
+
+#ifdef GUARDS
+	clientsz = sz;
+	sz += GUARD_OVERHEAD;
+#endif
+#ifdef LABELS
+#ifdef GUARDS
+	/* Include the label in what GUARDS considers the client data. */
+	clientsz += LABEL_PTROFFSET;
+#endif
+	sz += LABEL_PTROFFSET;
+#endif
+	blktype = blocktype(sz);
+#ifdef GUARDS
+	sz = sizes[blktype];
+#endif
+
+	retptr = subpage_get(blktype);
+	if (retptr == NULL) {
+		return NULL;
+	}
+
+#ifdef GUARDS
+	retptr = establishguardband(retptr, clientsz, sz);
+#endif
+#ifdef LABELS
+	retptr = establishlabel(retptr, label);
+#endif
+
+	return retptr;
 }
 
 /*
@@ -1029,8 +1390,6 @@ subpage_kfree(void *ptr)
 	vaddr_t ptraddr;	// same as ptr
 	struct pageref *pr;	// pageref for page we're freeing in
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
-	vaddr_t fla;		// free list entry address
-	struct freelist *fl;	// free list entry
 	vaddr_t offset;		// offset into page
 #ifdef GUARDS
 	size_t blocksize, smallerblocksize;
@@ -1061,34 +1420,16 @@ subpage_kfree(void *ptr)
 	ptraddr -= LABEL_PTROFFSET;
 #endif
 
-	spinlock_acquire(&kmalloc_spinlock);
-
-	checksubpages();
-
-	/* Silence warnings with gcc 4.8 -Og (but not -O2) */
-	prpage = 0;
-	blktype = 0;
-
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-		KASSERT(blktype >= 0 && blktype < NSIZES);
-
-		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
-		}
-	}
-
+	pr = subpage_lookup(ptraddr);
 	if (pr==NULL) {
 		/* Not on any of our pages - not a subpage allocation */
-		spinlock_release(&kmalloc_spinlock);
 		return -1;
 	}
 
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+	KASSERT(blktype >= 0 && blktype < NSIZES);
+
 	offset = ptraddr - prpage;
 
 	/* Check for proper positioning and alignment */
@@ -1112,49 +1453,7 @@ subpage_kfree(void *ptr)
 	 * We probably ought to check for free twice by seeing if the block
 	 * is already on the free list. But that's expensive, so we don't.
 	 */
-
-	fla = prpage + offset;
-	fl = (struct freelist *)fla;
-	if (pr->freelist_offset == INVALID_OFFSET) {
-		fl->next = NULL;
-	} else {
-		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
-
-		/* this block should not already be on the free list! */
-#ifdef SLOW
-		{
-			struct freelist *fl2;
-
-			for (fl2 = fl->next; fl2 != NULL; fl2 = fl2->next) {
-				KASSERT(fl2 != fl);
-			}
-		}
-#else
-		/* check just the head */
-		KASSERT(fl != fl->next);
-#endif
-	}
-	pr->freelist_offset = offset;
-	pr->nfree++;
-
-	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
-	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
-		/* Whole page is free. */
-		remove_lists(pr, blktype);
-		freepageref(pr);
-		/* Call free_kpages without kmalloc_spinlock. */
-		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
-	}
-	else {
-		spinlock_release(&kmalloc_spinlock);
-	}
-
-#ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
-	spinlock_acquire(&kmalloc_spinlock);
-	checksubpages();
-	spinlock_release(&kmalloc_spinlock);
-#endif
+	subpage_put(blktype, (struct freelist *)ptraddr);
 
 	return 0;
 }
@@ -1190,6 +1489,11 @@ kmalloc(size_t sz)
 		/* Round up to a whole number of pages. */
 		npages = (sz + PAGE_SIZE - 1)/PAGE_SIZE;
 		address = alloc_kpages(npages);
+		if (address==0) {
+			/* Cached blocks may free a page; give them back. */
+			subpage_drain_all();
+			address = alloc_kpages(npages);
+		}
 		if (address==0) {
 			return NULL;
 		}
@@ -0,0 +1,171 @@
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <kmemcache.h>
+
+/*
+ * Object caches (see kmemcache.h). The free objects of a cache are
+ * kept in an array, used as a stack so the most recently freed (and
+ * likely still in the processor cache) object goes out first.
+ */
+struct kmem_cache {
+	char *kc_name;
+	size_t kc_size;
+	int (*kc_ctor)(void *obj);
+	void (*kc_dtor)(void *obj);
+
+	struct spinlock kc_lock;	/* covers the rest */
+	void **kc_free;			/* free, constructed objects */
+	unsigned kc_nfree;
+	unsigned kc_maxfree;
+
+	unsigned kc_allocs;		/* kmem_cache_alloc calls */
+	unsigned kc_hits;		/* of those, served from kc_free */
+
+	struct kmem_cache *kc_next;	/* on kmem_caches */
+};
+
+/* Every cache, for kmem_cache_printstats() */
+static struct kmem_cache *kmem_caches;
+static struct spinlock kmem_caches_lock = SPINLOCK_INITIALIZER;
+
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size, unsigned maxfree,
+		  int (*ctor)(void *obj), void (*dtor)(void *obj))
+{
+	struct kmem_cache *kc;
+
+	KASSERT(size > 0);
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+	kc->kc_name = kstrdup(name);
+	if (kc->kc_name == NULL) {
+		kfree(kc);
+		return NULL;
+	}
+	kc->kc_free = NULL;
+	if (maxfree > 0) {
+		kc->kc_free = kmalloc(maxfree * sizeof(void *));
+		if (kc->kc_free == NULL) {
+			kfree(kc->kc_name);
+			kfree(kc);
+			return NULL;
+		}
+	}
+	kc->kc_size = size;
+	kc->kc_ctor = ctor;
+	kc->kc_dtor = dtor;
+	spinlock_init(&kc->kc_lock);
+	kc->kc_nfree = 0;
+	kc->kc_maxfree = maxfree;
+	kc->kc_allocs = 0;
+	kc->kc_hits = 0;
+
+	spinlock_acquire(&kmem_caches_lock);
+	kc->kc_next = kmem_caches;
+	kmem_caches = kc;
+	spinlock_release(&kmem_caches_lock);
+
+	return kc;
+}
+
+/*
+ * Destruct and free an object that is not going back in the cache.
+ */
+static
+void
+kmem_cache_release(struct kmem_cache *kc, void *obj)
+{
+	if (kc->kc_dtor != NULL) {
+		kc->kc_dtor(obj);
+	}
+	kfree(obj);
+}
+
+void
+kmem_cache_destroy(struct kmem_cache *kc)
+{
+	struct kmem_cache **p;
+
+	spinlock_acquire(&kmem_caches_lock);
+	for (p = &kmem_caches; *p != kc; p = &(*p)->kc_next) {
+		KASSERT(*p != NULL);
+	}
+	*p = kc->kc_next;
+	spinlock_release(&kmem_caches_lock);
+
+	while (kc->kc_nfree > 0) {
+		kmem_cache_release(kc, kc->kc_free[--kc->kc_nfree]);
+	}
+	spinlock_cleanup(&kc->kc_lock);
+	kfree(kc->kc_free);
+	kfree(kc->kc_name);
+	kfree(kc);
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	void *obj;
+	int result;
+
+	spinlock_acquire(&kc->kc_lock);
+	kc->kc_allocs++;
+	if (kc->kc_nfree > 0) {
+		kc->kc_hits++;
+		obj = kc->kc_free[--kc->kc_nfree];
+		spinlock_release(&kc->kc_lock);
+		return obj;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	/* The constructor may sleep, so call it without the lock. */
+	obj = kmalloc(kc->kc_size);
+	if (obj == NULL) {
+		return NULL;
+	}
+	if (kc->kc_ctor != NULL) {
+		result = kc->kc_ctor(obj);
+		if (result) {
+			kfree(obj);
+			return NULL;
+		}
+	}
+	return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	if (obj == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&kc->kc_lock);
+	if (kc->kc_nfree < kc->kc_maxfree) {
+		kc->kc_free[kc->kc_nfree++] = obj;
+		obj = NULL;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	if (obj != NULL) {
+		kmem_cache_release(kc, obj);
+	}
+}
+
+void
+kmem_cache_printstats(void)
+{
+	struct kmem_cache *kc;
+
+	spinlock_acquire(&kmem_caches_lock);
+	for (kc = kmem_caches; kc != NULL; kc = kc->kc_next) {
+		kprintf("%-16s %5zu bytes: %u of %u free, %u allocs, %u hits\n",
+			kc->kc_name, kc->kc_size, kc->kc_nfree,
+			kc->kc_maxfree, kc->kc_allocs, kc->kc_hits);
+	}
+	spinlock_release(&kmem_caches_lock);
+}
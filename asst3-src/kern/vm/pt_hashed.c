@@ -0,0 +1,339 @@
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <swap.h>
+#include <pagetable.h>
+#include <vmstats.h>
+
+/*
+    Hashed page table: one global table of entries for every address space,
+    hashed on (address space, page). A key hashes to a slot; if the slot is
+    taken the entry goes in the next free slot and is chained off the first.
+    Pages in swap keep their entries, and a frame shared copy-on-write has
+    one per page mapping it, so the table has twice as many entries as
+    there are frames, plus one for each swap slot.
+*/
+struct hpt_entry {
+    int pid;                // the address space the entry belongs to
+    uint32_t entryhi;       // the page it maps
+    struct pte pte;
+    struct hpt_entry *next; // next entry of the chain
+};
+
+// global hashed page table
+static struct hpt_entry *hpt;
+static uint32_t HPT_SIZE = 0;
+
+/*
+    The table is split into HPT_STRIPES equal, contiguous stripes, each with
+    its own lock. An entry only ever lives in the stripe its key hashes to:
+    the free-slot search wraps around within the stripe rather than the whole
+    table, so a collision chain never leaves it either. Holding a stripe's
+    lock therefore covers both every chain that starts in it and the search
+    for a free slot, and faults on pages that hash to different stripes run
+    in parallel.
+
+    Lock order: stripes in increasing order, then the frame table, then the
+    ASID lock. Nothing that can sleep may be called with a stripe held.
+*/
+#define HPT_STRIPES 16
+
+static struct spinlock hpt_locks[HPT_STRIPES];
+static uint32_t hpt_stripe_size;
+
+/*
+    Initializes the hash page table (HPT) by calculating its size,
+    allocating memory for it, and initializing each entry.
+*/
+static void hashed_bootstrap(void)
+{
+    // Get the total size of physical memory
+    paddr_t ram_size = ram_getsize();
+
+    // Calculate the size of the hash page table and allocate memory for it
+    // (rounded up so the stripes are all the same size); the swap device
+    // is already attached
+    hpt_stripe_size = DIVROUNDUP((ram_size / PAGE_SIZE) * 2 + swap_size(), HPT_STRIPES);
+    HPT_SIZE = hpt_stripe_size * HPT_STRIPES;
+    hpt = (struct hpt_entry *)kmalloc(sizeof(struct hpt_entry) * HPT_SIZE);
+    if (hpt == NULL)
+        panic("hpt: cannot allocate the page table\n");
+
+    // Initialize each hash page table entry
+    for (uint32_t i = 0; i < HPT_SIZE; i++)
+    {
+        hpt[i].pid = 0;     // The process ID for this entry
+        hpt[i].entryhi = 0; // The page this entry maps
+        hpt[i].pte.entrylo = 0; // The entrylo register for this entry
+        hpt[i].pte.swapped = false; // Whether the page is in swap
+        hpt[i].pte.swap_slot = 0; // Swap slot holding the page
+        hpt[i].next = NULL; // Pointer to next entry in case of collision
+    }
+
+    for (uint32_t i = 0; i < HPT_STRIPES; i++)
+        spinlock_init(&hpt_locks[i]);
+}
+
+/*
+    Computes the hash index for the given address space and virtual address.
+    An entry never leaves the stripe its key hashes to, so keys have to
+    spread evenly over the stripes: address spaces are kmalloc'ed and differ
+    only in the low bits of the pointer, and the same pages of several
+    processes, or consecutive pages of one, must not land in the same
+    stripe. Both halves of the key are therefore multiplied out before the
+    high bits are folded down, rather than just xor'ed.
+*/
+static uint32_t hpt_hash(struct addrspace *as, vaddr_t address)
+{
+    // Make sure the address is aligned to a page boundary.
+    KASSERT((address & PAGE_FRAME) == address);
+
+    uint32_t hash = ((uint32_t)as >> 4) * 0x85ebca6b + (address >> 12) * 0x9e3779b1;
+    hash ^= hash >> 16;
+    return hash % HPT_SIZE;
+}
+
+/*
+    Returns the lock of the stripe holding the given table index.
+*/
+static struct spinlock *hpt_stripe_lock(uint32_t index)
+{
+    return &hpt_locks[index / hpt_stripe_size];
+}
+
+/*
+    The table is global, so there is nothing to set up per address space.
+*/
+static int hashed_create(struct addrspace *as)
+{
+    (void)as;
+    return 0;
+}
+
+static void hashed_destroy(struct addrspace *as)
+{
+    (void)as;
+}
+
+/*
+    Locks the stripe that the entry for the given address space and virtual
+    address lives in.
+*/
+static void hashed_lock(struct addrspace *as, vaddr_t vaddr)
+{
+    spinlock_acquire(hpt_stripe_lock(hpt_hash(as, vaddr)));
+}
+
+static void hashed_unlock(struct addrspace *as, vaddr_t vaddr)
+{
+    spinlock_release(hpt_stripe_lock(hpt_hash(as, vaddr)));
+}
+
+/*
+    Retrieves the table entry for the given address space and virtual address.
+    Also returns the previous entry in the collision chain if requested.
+*/
+static struct hpt_entry *hpt_lookup(struct addrspace *as, vaddr_t vaddr, struct hpt_entry **prev_entry)
+{
+    // Ensure that the virtual address is page-aligned
+    KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+    // Hash the address and get the process ID
+    uint32_t index = hpt_hash(as, vaddr);
+    pid_t pid = (uint32_t)as;
+    KASSERT(spinlock_do_i_hold(hpt_stripe_lock(index)));
+
+    // Start at the hashed index and search the linked list of entries for a match
+    struct hpt_entry *curr_entry = &hpt[index];
+    unsigned probes = 0;
+    while (curr_entry != NULL)
+    {
+        probes++;
+        // If the entry matches the virtual address, process ID, and is in use, break out of the loop
+        if (curr_entry->entryhi == vaddr &&
+            pid == curr_entry->pid &&
+            PTE_INUSE(&curr_entry->pte))
+            break;
+        if (prev_entry)
+            *prev_entry = curr_entry;
+        curr_entry = curr_entry->next;
+    }
+
+    VMSTAT_ADD(vs_ptprobes, probes);
+
+    // Return the matching entry, or NULL if no match was found
+    return curr_entry;
+}
+
+static struct pte *hashed_get(struct addrspace *as, vaddr_t vaddr)
+{
+    struct hpt_entry *entry = hpt_lookup(as, vaddr, NULL);
+    return entry ? &entry->pte : NULL;
+}
+
+/*
+    Inserts an entry for the given address space and (page-aligned) virtual
+    address into the hash page table, chaining it off the hashed index if
+    that slot is taken. Returns NULL if the entry's stripe is full.
+*/
+static struct pte *hashed_insert(struct addrspace *as, vaddr_t vaddr, uint32_t entrylo)
+{
+    uint32_t index = hpt_hash(as, vaddr);
+    uint32_t curr_index = index;
+    uint32_t stripe_base = index - index % hpt_stripe_size;
+
+    KASSERT(spinlock_do_i_hold(hpt_stripe_lock(index)));
+
+    struct hpt_entry *entry = &hpt[curr_index];
+
+    // find the first unused entry, wrapping around within the stripe
+    while (PTE_INUSE(&entry->pte))
+    {
+        curr_index = stripe_base + (curr_index + 1 - stripe_base) % hpt_stripe_size;
+
+        if (curr_index == index)
+            return NULL; // No invalid entry found
+
+        entry = &hpt[curr_index];
+    }
+
+    // internal collision based on the initial hashed index
+    struct hpt_entry *curr_entry = &hpt[index];
+    if (PTE_INUSE(&curr_entry->pte))
+    {
+        while (curr_entry->next)
+            curr_entry = curr_entry->next;
+        curr_entry->next = entry;
+    }
+
+    entry->pid = (uint32_t)as;
+    entry->entryhi = vaddr;
+    entry->pte.entrylo = entrylo;
+    entry->pte.swapped = false;
+    entry->pte.swap_slot = 0;
+    entry->next = NULL;
+
+    return &entry->pte;
+}
+
+/*
+    Unlinks the entry for the given page from its chain and clears it.
+*/
+static void hashed_remove(struct addrspace *as, vaddr_t vaddr)
+{
+    struct hpt_entry *prev_entry = NULL;
+    struct hpt_entry *entry = hpt_lookup(as, vaddr, &prev_entry);
+    KASSERT(entry != NULL);
+
+    struct hpt_entry *remove_entry = entry;
+    if (prev_entry != NULL)
+    {
+        prev_entry->next = entry->next;
+    }
+    else if (entry->next != NULL)
+    {
+        struct hpt_entry *end_entry = entry;
+        prev_entry = end_entry;
+        // Find the last entry in the chain for the current page's hashed index
+        while (end_entry->next != NULL)
+        {
+            prev_entry = end_entry;
+            end_entry = end_entry->next;
+        }
+
+        // Replace the current page's entry with the last entry in the chain
+        entry->pid = end_entry->pid;
+        entry->entryhi = end_entry->entryhi;
+        entry->pte = end_entry->pte;
+        remove_entry = end_entry;
+        prev_entry->next = NULL; // removing the last entry
+    }
+
+    // Clear the removed entry's fields
+    remove_entry->pid = 0;
+    remove_entry->entryhi = 0;
+    remove_entry->pte.entrylo = 0;
+    remove_entry->pte.swapped = false;
+    remove_entry->pte.swap_slot = 0;
+}
+
+/*
+    Searches the table, a stripe at a time, for the entry mapping the frame.
+*/
+static bool hashed_find_frame(paddr_t paddr, struct addrspace **as, vaddr_t *vaddr)
+{
+    for (uint32_t stripe = 0; stripe < HPT_STRIPES; stripe++)
+    {
+        uint32_t base = stripe * hpt_stripe_size;
+
+        spinlock_acquire(&hpt_locks[stripe]);
+        for (uint32_t i = base; i < base + hpt_stripe_size; i++)
+        {
+            if ((hpt[i].pte.entrylo & TLBLO_VALID) &&
+                (hpt[i].pte.entrylo & TLBLO_PPAGE) == paddr)
+            {
+                *as = (struct addrspace *)hpt[i].pid;
+                *vaddr = hpt[i].entryhi;
+                spinlock_release(&hpt_locks[stripe]);
+                return true;
+            }
+        }
+        spinlock_release(&hpt_locks[stripe]);
+    }
+    return false;
+}
+
+/*
+    Prints how many entries are in use and how many entries a lookup visits
+    to find one, on average and at most.
+*/
+static void hashed_printstats(void)
+{
+    unsigned used = 0, probes = 0, maxprobes = 0;
+
+    for (uint32_t stripe = 0; stripe < HPT_STRIPES; stripe++)
+    {
+        uint32_t base = stripe * hpt_stripe_size;
+
+        spinlock_acquire(&hpt_locks[stripe]);
+        for (uint32_t i = base; i < base + hpt_stripe_size; i++)
+        {
+            if (!PTE_INUSE(&hpt[i].pte))
+                continue;
+
+            struct addrspace *as = (struct addrspace *)hpt[i].pid;
+            unsigned n = 1;
+            for (struct hpt_entry *e = &hpt[hpt_hash(as, hpt[i].entryhi)]; e != &hpt[i]; e = e->next)
+                n++;
+
+            used++;
+            probes += n;
+            if (n > maxprobes)
+                maxprobes = n;
+        }
+        spinlock_release(&hpt_locks[stripe]);
+    }
+
+    kprintf("hashed page table: %u of %u entries in use, %u bytes\n",
+            used, HPT_SIZE, HPT_SIZE * sizeof(struct hpt_entry));
+    kprintf("hashed page table: lookups visit %u.%02u entries on average, %u at most\n",
+            used ? probes / used : 0, used ? probes * 100 / used % 100 : 0, maxprobes);
+}
+
+const struct pagetable_ops hashed_pagetable = {
+    .pt_name = "hashed",
+    .pt_bootstrap = hashed_bootstrap,
+    .pt_create = hashed_create,
+    .pt_destroy = hashed_destroy,
+    .pt_lock = hashed_lock,
+    .pt_unlock = hashed_unlock,
+    .pt_get = hashed_get,
+    .pt_reserve = NULL, // entries are preallocated
+    .pt_insert = hashed_insert,
+    .pt_remove = hashed_remove,
+    .pt_find_frame = hashed_find_frame,
+    .pt_printstats = hashed_printstats,
+};
@@ -0,0 +1,273 @@
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <swap.h>
+#include <pagetable.h>
+#include <vmstats.h>
+
+/*
+    Inverted page table: one global table of entries, sized by physical
+    memory rather than by the address spaces, with a hash anchor table in
+    front of it. A key (address space, page) hashes to an anchor, which
+    holds the index of the first entry of its chain; entries are chained by
+    index too.
+
+    Unlike the textbook table, an entry is not tied to the frame it maps:
+    a frame can be shared copy-on-write by several entries, and pages in
+    swap keep their entries without a frame. Entries are handed out from a
+    free list instead, and there are twice as many as frames, plus one for
+    each swap slot. The anchor table has a power of two of slots, at least
+    as many as frames, so the hash is a mask.
+*/
+#define IPT_NONE 0xffffffff
+
+struct ipt_entry {
+    struct addrspace *as;   // the address space the entry belongs to
+    vaddr_t vaddr;          // the page it maps
+    struct pte pte;
+    uint32_t next;          // index of the next entry of the chain
+};
+
+static struct ipt_entry *ipt;
+static uint32_t ipt_size;
+static uint32_t *ipt_anchors;
+static uint32_t ipt_nanchors;
+
+/*
+    Anchors are locked in IPT_STRIPES interleaved groups; a lock covers the
+    chains of its anchors. The free list has a lock of its own, taken after.
+*/
+#define IPT_STRIPES 16
+
+static struct spinlock ipt_locks[IPT_STRIPES];
+static struct spinlock ipt_free_lock = SPINLOCK_INITIALIZER;
+static uint32_t ipt_free;     // first free entry, chained through next
+
+static void inverted_bootstrap(void)
+{
+    uint32_t nframes = ram_getsize() / PAGE_SIZE;
+
+    ipt_size = nframes * 2 + swap_size();
+    ipt = kmalloc(ipt_size * sizeof(struct ipt_entry));
+
+    ipt_nanchors = IPT_STRIPES;
+    while (ipt_nanchors < nframes)
+        ipt_nanchors *= 2;
+    ipt_anchors = kmalloc(ipt_nanchors * sizeof(uint32_t));
+
+    if (ipt == NULL || ipt_anchors == NULL)
+        panic("ipt: cannot allocate the page table\n");
+
+    for (uint32_t i = 0; i < ipt_size; i++)
+    {
+        ipt[i].as = NULL;
+        ipt[i].vaddr = 0;
+        ipt[i].pte.entrylo = 0;
+        ipt[i].pte.swapped = false;
+        ipt[i].pte.swap_slot = 0;
+        ipt[i].next = i + 1 < ipt_size ? i + 1 : IPT_NONE;
+    }
+    ipt_free = 0;
+
+    for (uint32_t i = 0; i < ipt_nanchors; i++)
+        ipt_anchors[i] = IPT_NONE;
+
+    for (uint32_t i = 0; i < IPT_STRIPES; i++)
+        spinlock_init(&ipt_locks[i]);
+}
+
+/*
+    Hashes the key to an anchor. Address spaces are kmalloc'ed, so the low
+    bits of the pointer carry nothing, and consecutive pages of one address
+    space should spread over the whole anchor table.
+*/
+static uint32_t ipt_hash(struct addrspace *as, vaddr_t vaddr)
+{
+    KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+    uint32_t hash = ((uint32_t)as >> 4) + (vaddr >> 12) * 0x9e3779b1;
+    hash ^= hash >> 16;
+    return hash & (ipt_nanchors - 1);
+}
+
+static struct spinlock *ipt_lock(uint32_t anchor)
+{
+    return &ipt_locks[anchor % IPT_STRIPES];
+}
+
+// the table is global, so there is nothing to set up per address space
+static int inverted_create(struct addrspace *as)
+{
+    (void)as;
+    return 0;
+}
+
+static void inverted_destroy(struct addrspace *as)
+{
+    (void)as;
+}
+
+static void inverted_lock(struct addrspace *as, vaddr_t vaddr)
+{
+    spinlock_acquire(ipt_lock(ipt_hash(as, vaddr)));
+}
+
+static void inverted_unlock(struct addrspace *as, vaddr_t vaddr)
+{
+    spinlock_release(ipt_lock(ipt_hash(as, vaddr)));
+}
+
+static struct pte *inverted_get(struct addrspace *as, vaddr_t vaddr)
+{
+    uint32_t anchor = ipt_hash(as, vaddr);
+    KASSERT(spinlock_do_i_hold(ipt_lock(anchor)));
+
+    unsigned probes = 0;
+    struct pte *pte = NULL;
+    for (uint32_t i = ipt_anchors[anchor]; i != IPT_NONE; i = ipt[i].next)
+    {
+        probes++;
+        if (ipt[i].as == as && ipt[i].vaddr == vaddr)
+        {
+            pte = &ipt[i].pte;
+            break;
+        }
+    }
+    VMSTAT_ADD(vs_ptprobes, probes);
+    return pte;
+}
+
+/*
+    Takes an entry off the free list and puts it at the head of the key's
+    chain. Returns NULL if every entry is in use.
+*/
+static struct pte *inverted_insert(struct addrspace *as, vaddr_t vaddr, uint32_t entrylo)
+{
+    uint32_t anchor = ipt_hash(as, vaddr);
+    KASSERT(spinlock_do_i_hold(ipt_lock(anchor)));
+
+    spinlock_acquire(&ipt_free_lock);
+    uint32_t i = ipt_free;
+    if (i != IPT_NONE)
+        ipt_free = ipt[i].next;
+    spinlock_release(&ipt_free_lock);
+    if (i == IPT_NONE)
+        return NULL;
+
+    ipt[i].as = as;
+    ipt[i].vaddr = vaddr;
+    ipt[i].pte.entrylo = entrylo;
+    ipt[i].pte.swapped = false;
+    ipt[i].pte.swap_slot = 0;
+    ipt[i].next = ipt_anchors[anchor];
+    ipt_anchors[anchor] = i;
+
+    return &ipt[i].pte;
+}
+
+/*
+    Unlinks the entry for the page from its chain and frees it.
+*/
+static void inverted_remove(struct addrspace *as, vaddr_t vaddr)
+{
+    uint32_t anchor = ipt_hash(as, vaddr);
+    KASSERT(spinlock_do_i_hold(ipt_lock(anchor)));
+
+    uint32_t *link = &ipt_anchors[anchor];
+    while (*link != IPT_NONE && (ipt[*link].as != as || ipt[*link].vaddr != vaddr))
+        link = &ipt[*link].next;
+    KASSERT(*link != IPT_NONE);
+
+    uint32_t i = *link;
+    *link = ipt[i].next;
+
+    ipt[i].as = NULL;
+    ipt[i].vaddr = 0;
+    ipt[i].pte.entrylo = 0;
+    ipt[i].pte.swapped = false;
+    ipt[i].pte.swap_slot = 0;
+
+    spinlock_acquire(&ipt_free_lock);
+    ipt[i].next = ipt_free;
+    ipt_free = i;
+    spinlock_release(&ipt_free_lock);
+}
+
+/*
+    Walks the chains, a lock's worth of anchors at a time, for the entry
+    mapping the frame.
+*/
+static bool inverted_find_frame(paddr_t paddr, struct addrspace **as, vaddr_t *vaddr)
+{
+    for (uint32_t stripe = 0; stripe < IPT_STRIPES; stripe++)
+    {
+        spinlock_acquire(&ipt_locks[stripe]);
+        for (uint32_t anchor = stripe; anchor < ipt_nanchors; anchor += IPT_STRIPES)
+        {
+            for (uint32_t i = ipt_anchors[anchor]; i != IPT_NONE; i = ipt[i].next)
+            {
+                if ((ipt[i].pte.entrylo & TLBLO_VALID) &&
+                    (ipt[i].pte.entrylo & TLBLO_PPAGE) == paddr)
+                {
+                    *as = ipt[i].as;
+                    *vaddr = ipt[i].vaddr;
+                    spinlock_release(&ipt_locks[stripe]);
+                    return true;
+                }
+            }
+        }
+        spinlock_release(&ipt_locks[stripe]);
+    }
+    return false;
+}
+
+/*
+    Prints how many entries are in use and how long the chains are.
+*/
+static void inverted_printstats(void)
+{
+    unsigned used = 0, chains = 0, maxchain = 0;
+
+    for (uint32_t stripe = 0; stripe < IPT_STRIPES; stripe++)
+    {
+        spinlock_acquire(&ipt_locks[stripe]);
+        for (uint32_t anchor = stripe; anchor < ipt_nanchors; anchor += IPT_STRIPES)
+        {
+            unsigned n = 0;
+            for (uint32_t i = ipt_anchors[anchor]; i != IPT_NONE; i = ipt[i].next)
+                n++;
+
+            if (n > 0)
+                chains++;
+            used += n;
+            if (n > maxchain)
+                maxchain = n;
+        }
+        spinlock_release(&ipt_locks[stripe]);
+    }
+
+    kprintf("inverted page table: %u of %u entries in use, %u bytes\n",
+            used, ipt_size,
+            ipt_size * sizeof(struct ipt_entry) + ipt_nanchors * sizeof(uint32_t));
+    kprintf("inverted page table: %u of %u anchors in use, chains %u.%02u long on average, %u at most\n",
+            chains, ipt_nanchors,
+            chains ? used / chains : 0, chains ? used * 100 / chains % 100 : 0, maxchain);
+}
+
+const struct pagetable_ops inverted_pagetable = {
+    .pt_name = "inverted",
+    .pt_bootstrap = inverted_bootstrap,
+    .pt_create = inverted_create,
+    .pt_destroy = inverted_destroy,
+    .pt_lock = inverted_lock,
+    .pt_unlock = inverted_unlock,
+    .pt_get = inverted_get,
+    .pt_reserve = NULL, // entries are preallocated
+    .pt_insert = inverted_insert,
+    .pt_remove = inverted_remove,
+    .pt_find_frame = inverted_find_frame,
+    .pt_printstats = inverted_printstats,
+};
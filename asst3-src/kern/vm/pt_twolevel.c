@@ -0,0 +1,322 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <pagetable.h>
+#include <vmstats.h>
+
+/*
+    Two-level page table: each address space has a directory of TL_DIRSIZE
+    pointers to tables of TL_TABLESIZE entries, so a lookup is two memory
+    references however many pages are mapped. The directory is allocated
+    with the address space and covers the user half of the address space;
+    tables are allocated the first time one of their pages is mapped and
+    kept until the address space is destroyed. Both are a page each.
+
+    Every directory is also on a list of them all, so that the pager can
+    search them for a frame whose owner it does not know.
+*/
+#define TL_PAGEBITS 12  // log2(PAGE_SIZE)
+#define TL_TABLEBITS 9
+#define TL_TABLESIZE (1 << TL_TABLEBITS)
+#define TL_DIRSIZE (MIPS_KSEG0 >> (TL_PAGEBITS + TL_TABLEBITS))
+
+#define TL_DIRINDEX(vaddr) ((vaddr) >> (TL_PAGEBITS + TL_TABLEBITS))
+#define TL_TABLEINDEX(vaddr) (((vaddr) >> TL_PAGEBITS) & (TL_TABLESIZE - 1))
+#define TL_VADDR(dirindex, tableindex) \
+    (((vaddr_t)(dirindex) << (TL_PAGEBITS + TL_TABLEBITS)) | \
+     ((vaddr_t)(tableindex) << TL_PAGEBITS))
+
+// An address space's page table, as pointed to by its pt_data
+struct tl_space {
+    struct tl_space *next, *prev;   // on tl_spaces
+    struct addrspace *as;
+    struct pte **dir;
+};
+
+/*
+    The tables belong to the address space, but the locks cannot: the pager
+    may take one for an address space that is being destroyed. Entries are
+    locked by directory slot, hashed into TL_STRIPES global locks, and a
+    slot's lock also covers filling it in with a new table.
+*/
+#define TL_STRIPES 16
+
+static struct spinlock tl_locks[TL_STRIPES];
+
+/*
+    Every address space's page table, for twolevel_find_frame(). Taken
+    before the stripe locks.
+*/
+static struct spinlock tl_spaces_lock = SPINLOCK_INITIALIZER;
+static struct tl_space *tl_spaces = NULL;
+
+// directories, tables and entries in use, for twolevel_printstats()
+static struct spinlock tl_stats_lock = SPINLOCK_INITIALIZER;
+static unsigned tl_ndirs = 0;
+static unsigned tl_ntables = 0;
+static unsigned tl_nentries = 0;
+
+static void twolevel_bootstrap(void)
+{
+    for (uint32_t i = 0; i < TL_STRIPES; i++)
+        spinlock_init(&tl_locks[i]);
+}
+
+static struct spinlock *tl_lock(struct addrspace *as, vaddr_t vaddr)
+{
+    uint32_t hash = ((uint32_t)as >> 4) ^ TL_DIRINDEX(vaddr);
+    return &tl_locks[hash % TL_STRIPES];
+}
+
+/*
+    Allocates the empty directory of a new address space.
+*/
+static int twolevel_create(struct addrspace *as)
+{
+    struct tl_space *space = kmalloc(sizeof(struct tl_space));
+    if (space == NULL)
+        return ENOMEM;
+
+    struct pte **dir = kmalloc(TL_DIRSIZE * sizeof(struct pte *));
+    if (dir == NULL)
+    {
+        kfree(space);
+        return ENOMEM;
+    }
+
+    for (uint32_t i = 0; i < TL_DIRSIZE; i++)
+        dir[i] = NULL;
+    space->as = as;
+    space->dir = dir;
+    as->pt_data = space;
+
+    spinlock_acquire(&tl_spaces_lock);
+    space->prev = NULL;
+    space->next = tl_spaces;
+    if (tl_spaces != NULL)
+        tl_spaces->prev = space;
+    tl_spaces = space;
+    spinlock_release(&tl_spaces_lock);
+
+    spinlock_acquire(&tl_stats_lock);
+    tl_ndirs++;
+    spinlock_release(&tl_stats_lock);
+    return 0;
+}
+
+/*
+    Frees the directory and tables of an address space with no pages left.
+*/
+static void twolevel_destroy(struct addrspace *as)
+{
+    struct tl_space *space = as->pt_data;
+    struct pte **dir = space->dir;
+    unsigned ntables = 0;
+
+    // wait out any search of the directory
+    spinlock_acquire(&tl_spaces_lock);
+    if (space->prev != NULL)
+        space->prev->next = space->next;
+    else
+        tl_spaces = space->next;
+    if (space->next != NULL)
+        space->next->prev = space->prev;
+    spinlock_release(&tl_spaces_lock);
+
+    for (uint32_t i = 0; i < TL_DIRSIZE; i++)
+    {
+        if (dir[i] == NULL)
+            continue;
+        kfree(dir[i]);
+        ntables++;
+    }
+    kfree(dir);
+    kfree(space);
+    as->pt_data = NULL;
+
+    spinlock_acquire(&tl_stats_lock);
+    tl_ndirs--;
+    tl_ntables -= ntables;
+    spinlock_release(&tl_stats_lock);
+}
+
+static void twolevel_lock(struct addrspace *as, vaddr_t vaddr)
+{
+    spinlock_acquire(tl_lock(as, vaddr));
+}
+
+static void twolevel_unlock(struct addrspace *as, vaddr_t vaddr)
+{
+    spinlock_release(tl_lock(as, vaddr));
+}
+
+static struct pte *twolevel_get(struct addrspace *as, vaddr_t vaddr)
+{
+    KASSERT(spinlock_do_i_hold(tl_lock(as, vaddr)));
+    KASSERT(vaddr < MIPS_KSEG0);
+
+    struct pte **dir = ((struct tl_space *)as->pt_data)->dir;
+    struct pte *table = dir[TL_DIRINDEX(vaddr)];
+    if (table == NULL)
+    {
+        VMSTAT_ADD(vs_ptprobes, 1);
+        return NULL;
+    }
+
+    VMSTAT_ADD(vs_ptprobes, 2);
+    struct pte *entry = &table[TL_TABLEINDEX(vaddr)];
+    return PTE_INUSE(entry) ? entry : NULL;
+}
+
+/*
+    Allocates the table for the page if it has none yet. The table is
+    allocated before taking the slot's lock and only put in place if no one
+    else has done so meanwhile.
+*/
+static int twolevel_reserve(struct addrspace *as, vaddr_t vaddr)
+{
+    KASSERT(vaddr < MIPS_KSEG0);
+
+    struct pte **dir = ((struct tl_space *)as->pt_data)->dir;
+
+    twolevel_lock(as, vaddr);
+    bool present = dir[TL_DIRINDEX(vaddr)] != NULL;
+    twolevel_unlock(as, vaddr);
+    if (present)
+        return 0;
+
+    struct pte *table = kmalloc(TL_TABLESIZE * sizeof(struct pte));
+    if (table == NULL)
+        return ENOMEM;
+    bzero(table, TL_TABLESIZE * sizeof(struct pte));
+
+    twolevel_lock(as, vaddr);
+    if (dir[TL_DIRINDEX(vaddr)] == NULL)
+    {
+        dir[TL_DIRINDEX(vaddr)] = table;
+        table = NULL;
+
+        spinlock_acquire(&tl_stats_lock);
+        tl_ntables++;
+        spinlock_release(&tl_stats_lock);
+    }
+    twolevel_unlock(as, vaddr);
+
+    // another thread got there first
+    if (table != NULL)
+        kfree(table);
+    return 0;
+}
+
+/*
+    Fills in the entry for the page, in the table twolevel_reserve() made
+    sure it has.
+*/
+static struct pte *twolevel_insert(struct addrspace *as, vaddr_t vaddr, uint32_t entrylo)
+{
+    KASSERT(spinlock_do_i_hold(tl_lock(as, vaddr)));
+    KASSERT(vaddr < MIPS_KSEG0);
+
+    struct pte **dir = ((struct tl_space *)as->pt_data)->dir;
+    struct pte *table = dir[TL_DIRINDEX(vaddr)];
+    KASSERT(table != NULL);
+
+    struct pte *entry = &table[TL_TABLEINDEX(vaddr)];
+    KASSERT(!PTE_INUSE(entry));
+    entry->entrylo = entrylo;
+    entry->swapped = false;
+    entry->swap_slot = 0;
+
+    spinlock_acquire(&tl_stats_lock);
+    tl_nentries++;
+    spinlock_release(&tl_stats_lock);
+
+    return entry;
+}
+
+static void twolevel_remove(struct addrspace *as, vaddr_t vaddr)
+{
+    struct pte *entry = twolevel_get(as, vaddr);
+    KASSERT(entry != NULL);
+
+    entry->entrylo = 0;
+    entry->swapped = false;
+    entry->swap_slot = 0;
+
+    spinlock_acquire(&tl_stats_lock);
+    tl_nentries--;
+    spinlock_release(&tl_stats_lock);
+}
+
+/*
+    Searches every address space's tables, a directory slot at a time, for
+    the entry mapping the frame. Slow, but only needed for frames that were
+    shared and whose owner let go of them.
+*/
+static bool twolevel_find_frame(paddr_t paddr, struct addrspace **as, vaddr_t *vaddr)
+{
+    spinlock_acquire(&tl_spaces_lock);
+    for (struct tl_space *space = tl_spaces; space != NULL; space = space->next)
+    {
+        for (uint32_t i = 0; i < TL_DIRSIZE; i++)
+        {
+            // Tables stay until the directory goes, which cannot happen
+            // meanwhile, and one added since cannot map the frame.
+            struct pte *table = space->dir[i];
+            if (table == NULL)
+                continue;
+
+            vaddr_t base = TL_VADDR(i, 0);
+            twolevel_lock(space->as, base);
+            for (uint32_t j = 0; j < TL_TABLESIZE; j++)
+            {
+                if ((table[j].entrylo & TLBLO_VALID) &&
+                    (table[j].entrylo & TLBLO_PPAGE) == paddr)
+                {
+                    *as = space->as;
+                    *vaddr = TL_VADDR(i, j);
+                    twolevel_unlock(space->as, base);
+                    spinlock_release(&tl_spaces_lock);
+                    return true;
+                }
+            }
+            twolevel_unlock(space->as, base);
+        }
+    }
+    spinlock_release(&tl_spaces_lock);
+    return false;
+}
+
+static void twolevel_printstats(void)
+{
+    spinlock_acquire(&tl_stats_lock);
+    unsigned ndirs = tl_ndirs;
+    unsigned ntables = tl_ntables;
+    unsigned nentries = tl_nentries;
+    spinlock_release(&tl_stats_lock);
+
+    kprintf("two-level page table: %u entries in %u directories and %u tables, %u bytes\n",
+            nentries, ndirs, ntables,
+            ndirs * (sizeof(struct tl_space) + TL_DIRSIZE * sizeof(struct pte *)) +
+            ntables * TL_TABLESIZE * sizeof(struct pte));
+    kprintf("two-level page table: lookups visit 2 levels\n");
+}
+
+const struct pagetable_ops twolevel_pagetable = {
+    .pt_name = "two-level",
+    .pt_bootstrap = twolevel_bootstrap,
+    .pt_create = twolevel_create,
+    .pt_destroy = twolevel_destroy,
+    .pt_lock = twolevel_lock,
+    .pt_unlock = twolevel_unlock,
+    .pt_get = twolevel_get,
+    .pt_reserve = twolevel_reserve,
+    .pt_insert = twolevel_insert,
+    .pt_remove = twolevel_remove,
+    .pt_find_frame = twolevel_find_frame,
+    .pt_printstats = twolevel_printstats,
+};
@@ -0,0 +1,197 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <synch.h>
+#include <uio.h>
+#include <stat.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <swap.h>
+#include <textcache.h>
+#include <zeropool.h>
+
+/* Swap device, or NULL if we are running without one */
+static struct vnode *swap_vnode = NULL;
+
+/* One bit per page-sized slot on the swap device */
+static struct bitmap *swap_map;
+static uint32_t swap_nslots;
+
+/*
+ * Serializes paging I/O and protects swap_map. A page out holds it from
+ * choosing a slot until the page has reached the disk, so a page in of
+ * the same slot waits for the write to finish.
+ */
+static struct lock *swap_lock;
+
+/*
+    Attaches the swap device and sizes the slot bitmap to it. Without a
+    swap device the VM runs as before and fails allocations with ENOMEM
+    once memory is full.
+*/
+void swap_bootstrap(void)
+{
+    struct stat st;
+    int result;
+
+    swap_lock = lock_create("swap");
+    if (swap_lock == NULL)
+        panic("swap: cannot create swap lock\n");
+
+    result = vfs_swapon(SWAP_DEVICE, &swap_vnode);
+    if (result)
+    {
+        kprintf("swap: no swap device (%s), paging disabled\n", strerror(result));
+        swap_vnode = NULL;
+        return;
+    }
+
+    result = VOP_STAT(swap_vnode, &st);
+    if (result)
+        panic("swap: cannot stat swap device: %s\n", strerror(result));
+
+    swap_nslots = st.st_size / PAGE_SIZE;
+    swap_map = bitmap_create(swap_nslots);
+    if (swap_map == NULL)
+        panic("swap: cannot create swap bitmap\n");
+
+    kprintf("swap: %uk swap space available\n", swap_nslots * PAGE_SIZE / 1024);
+}
+
+/*
+    Number of slots on the swap device; 0 if there is none.
+*/
+uint32_t swap_size(void)
+{
+    return swap_vnode == NULL ? 0 : swap_nslots;
+}
+
+/*
+    Transfers one page between the frame at kvaddr and the given slot.
+    The caller holds swap_lock.
+*/
+static int swap_io(uint32_t slot, vaddr_t kvaddr, enum uio_rw rw)
+{
+    struct iovec iov;
+    struct uio ku;
+    int result;
+
+    KASSERT(lock_do_i_hold(swap_lock));
+    KASSERT(slot < swap_nslots);
+
+    uio_kinit(&iov, &ku, (void *)kvaddr, PAGE_SIZE, (off_t)slot * PAGE_SIZE, rw);
+    result = rw == UIO_READ ? VOP_READ(swap_vnode, &ku) : VOP_WRITE(swap_vnode, &ku);
+    if (result)
+        return result;
+
+    return ku.uio_resid == 0 ? 0 : EIO;
+}
+
+/*
+    Reads the page in the given slot into the frame at kvaddr.
+*/
+int swap_read(uint32_t slot, vaddr_t kvaddr)
+{
+    lock_acquire(swap_lock);
+    int result = swap_io(slot, kvaddr, UIO_READ);
+    lock_release(swap_lock);
+    return result;
+}
+
+/*
+    Releases a slot whose page is no longer needed.
+*/
+void swap_free(uint32_t slot)
+{
+    lock_acquire(swap_lock);
+    KASSERT(bitmap_isset(swap_map, slot));
+    bitmap_unmark(swap_map, slot);
+    lock_release(swap_lock);
+}
+
+/*
+    Frees up one frame by writing a user page out to swap. The victim is
+    chosen by the frame table's clock, and its page table entry is switched
+    over to the swap slot before the write so its owner faults (and waits
+    for us) instead of touching the page while it is on its way out.
+*/
+static int swap_evict(void)
+{
+    struct addrspace *as;
+    vaddr_t vaddr, victim;
+    uint32_t slot;
+    int result;
+
+    if (swap_vnode == NULL)
+        return ENOMEM; // no swap; memory is simply full
+
+    lock_acquire(swap_lock);
+
+    if (bitmap_alloc(swap_map, &slot))
+    {
+        lock_release(swap_lock);
+        return ENOMEM; // out of swap too
+    }
+
+    // Choose a victim and unmap it; hpt_pageout() refuses frames that were
+    // freed or shared between the two steps.
+    while (1)
+    {
+        victim = frame_choose_victim(&as, &vaddr);
+        if (victim == 0)
+        {
+            bitmap_unmark(swap_map, slot);
+            lock_release(swap_lock);
+            return ENOMEM;
+        }
+        if (hpt_pageout(as, vaddr, victim, slot))
+            break;
+        // the frame was in transit (e.g. being freed); try another
+        frame_release_victim(victim);
+    }
+
+    result = swap_io(slot, victim, UIO_WRITE);
+    if (result)
+        panic("swap: cannot write page to slot %u: %s\n", slot, strerror(result));
+
+    lock_release(swap_lock);
+
+    free_kpages(victim);
+    return 0;
+}
+
+/*
+    Allocates a frame for a user page, dropping idle pages from the text cache
+    or paging out other pages while fewer than SWAP_RESERVE frames are free,
+    since the kernel's own allocations never page anything out. Frames idle
+    in the zero pool are taken before any page goes to disk. Only once
+    nothing more can be paged out does a user page take one of the reserve.
+    The frame is returned pinned and recorded as mapping vaddr in as.
+*/
+vaddr_t alloc_upage(struct addrspace *as, vaddr_t vaddr)
+{
+    vaddr_t kvaddr = 0;
+
+    while (kvaddr == 0)
+    {
+        if (frame_free_count() >= SWAP_RESERVE &&
+            (kvaddr = alloc_kpages(1)) != 0)
+            break;
+        // pages of executables no one is running are cheaper to lose
+        if (textcache_reclaim() > 0)
+            continue;
+        if ((kvaddr = zeropool_reclaim()) != 0)
+            break;
+        if (swap_evict() == 0)
+            continue;
+        kvaddr = alloc_kpages(1);
+        if (kvaddr == 0)
+            return 0;
+    }
+
+    frame_set_owner(kvaddr, as, vaddr);
+    return kvaddr;
+}
@@ -0,0 +1,353 @@
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vnode.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <textcache.h>
+
+/*
+    A cached page is keyed by its file and the file offset the page starts
+    at, plus the bytes of it that come from the file (the rest is zero), so
+    that regions of the same executable map to the same pages however they
+    are laid out. The offset is that of the page's first byte even when the
+    segment starts part of the way into the page, so it may be negative.
+*/
+struct tc_page {
+    struct tc_page *next;       // hash chain
+    struct tc_page *file_next;  // pages of the same file
+    struct tc_file *file;
+    off_t offset;
+    unsigned start, end;        // bytes of the page read from the file
+    vaddr_t frame;
+};
+
+// An executable with pages in the cache; the cache holds a reference to it.
+struct tc_file {
+    struct vnode *vnode;        // NULL if the slot is free
+    struct tc_page *pages;
+    unsigned npages;
+};
+
+static struct tc_page *tc_buckets[TEXTCACHE_BUCKETS];
+static struct tc_file tc_files[TEXTCACHE_FILES];
+static unsigned tc_npages = 0;
+
+// faults on read-only file pages that found them cached, and that did not
+static unsigned tc_hits = 0;
+static unsigned tc_misses = 0;
+
+/*
+    Counts calls to textcache_invalidate(), for files grouped by a hash of
+    the vnode. A page read from its file is only added if there were none for
+    the file's group since the lookup that missed it, since the read may then
+    have raced with a write. Writes to other files seldom hold it up.
+*/
+static unsigned tc_generations[TEXTCACHE_BUCKETS];
+
+/*
+    Protects the cache and counters. It is taken before the frame table's
+    locks; vnodes are only let go of after it is released, since that may
+    sleep.
+*/
+static struct spinlock tc_lock = SPINLOCK_INITIALIZER;
+
+/*
+    Only pages of program segments that can never be written are shared.
+*/
+static bool tc_cacheable(struct as_regions *region)
+{
+    return region->type == REGION_SEGMENT && region->vnode != NULL &&
+           !(region->permissions & WRITE);
+}
+
+static void tc_key(struct as_regions *region, vaddr_t vaddr,
+                   off_t *offset, unsigned *start, unsigned *end)
+{
+    KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+    vaddr_t file_end = region->file_vaddr + region->file_size;
+    vaddr_t first = vaddr > region->file_vaddr ? vaddr : region->file_vaddr;
+    vaddr_t last = vaddr + PAGE_SIZE < file_end ? vaddr + PAGE_SIZE : file_end;
+
+    *offset = region->file_offset + ((off_t)vaddr - (off_t)region->file_vaddr);
+    *start = first < last ? first - vaddr : 0;
+    *end = first < last ? last - vaddr : 0;
+}
+
+static unsigned *tc_generation(struct vnode *vn)
+{
+    return &tc_generations[((uint32_t)vn >> 4) % TEXTCACHE_BUCKETS];
+}
+
+static struct tc_page **tc_bucket(struct vnode *vn, off_t offset)
+{
+    uint32_t hash = ((uint32_t)vn >> 4) + (uint32_t)(offset >> 12) * 0x9e3779b1;
+    hash ^= hash >> 16;
+    return &tc_buckets[hash % TEXTCACHE_BUCKETS];
+}
+
+static struct tc_page *tc_find(struct vnode *vn, off_t offset, unsigned start, unsigned end)
+{
+    KASSERT(spinlock_do_i_hold(&tc_lock));
+
+    for (struct tc_page *page = *tc_bucket(vn, offset); page != NULL; page = page->next)
+    {
+        if (page->file->vnode == vn && page->offset == offset &&
+            page->start == start && page->end == end)
+            return page;
+    }
+    return NULL;
+}
+
+/*
+    Removes a page from the cache and drops its reference to the frame. If it
+    was the file's last page, the file's slot is freed and its vnode added to
+    drop[], for the caller to let go of once the lock is released.
+*/
+static void tc_remove(struct tc_page *page, struct vnode **drop, unsigned *ndrop)
+{
+    KASSERT(spinlock_do_i_hold(&tc_lock));
+
+    struct tc_page **link = tc_bucket(page->file->vnode, page->offset);
+    while (*link != page)
+        link = &(*link)->next;
+    *link = page->next;
+
+    struct tc_file *file = page->file;
+    link = &file->pages;
+    while (*link != page)
+        link = &(*link)->file_next;
+    *link = page->file_next;
+
+    // whoever still maps the frame may have it paged out from now on
+    frame_allow_paging(page->frame);
+    free_kpages(page->frame);
+    kfree(page);
+    tc_npages--;
+
+    if (--file->npages == 0)
+    {
+        drop[(*ndrop)++] = file->vnode;
+        file->vnode = NULL;
+    }
+}
+
+/*
+    Removes up to max pages whose frames no process maps any more. Returns how
+    many were removed.
+*/
+static unsigned tc_evict_idle(unsigned max, struct vnode **drop, unsigned *ndrop)
+{
+    KASSERT(spinlock_do_i_hold(&tc_lock));
+
+    unsigned evicted = 0;
+    for (unsigned i = 0; i < TEXTCACHE_BUCKETS && evicted < max; i++)
+    {
+        struct tc_page *page = tc_buckets[i];
+        while (page != NULL && evicted < max)
+        {
+            struct tc_page *next = page->next;
+            // only the cache's reference is left, and no new one can be
+            // taken without the lock
+            if (kpage_refcount(page->frame) == 1)
+            {
+                tc_remove(page, drop, ndrop);
+                evicted++;
+            }
+            page = next;
+        }
+    }
+    return evicted;
+}
+
+static void tc_drop(struct vnode **drop, unsigned ndrop)
+{
+    for (unsigned i = 0; i < ndrop; i++)
+        VOP_DECREF(drop[i]);
+}
+
+/*
+    Finds the file's slot, or takes a free one for it. Returns NULL if every
+    slot is in use by another file.
+*/
+static struct tc_file *tc_file_get(struct vnode *vn)
+{
+    struct tc_file *free = NULL;
+
+    for (unsigned i = 0; i < TEXTCACHE_FILES; i++)
+    {
+        if (tc_files[i].vnode == vn)
+            return &tc_files[i];
+        if (tc_files[i].vnode == NULL && free == NULL)
+            free = &tc_files[i];
+    }
+
+    if (free != NULL)
+    {
+        VOP_INCREF(vn);
+        free->vnode = vn;
+        free->pages = NULL;
+        free->npages = 0;
+    }
+    return free;
+}
+
+vaddr_t textcache_get(struct as_regions *region, vaddr_t vaddr, unsigned *generation)
+{
+    if (!tc_cacheable(region))
+        return 0;
+
+    off_t offset;
+    unsigned start, end;
+    tc_key(region, vaddr, &offset, &start, &end);
+
+    vaddr_t frame = 0;
+    spinlock_acquire(&tc_lock);
+    *generation = *tc_generation(region->vnode);
+    struct tc_page *page = tc_find(region->vnode, offset, start, end);
+    if (page != NULL)
+    {
+        frame = page->frame;
+        ref_kpage(frame);
+        tc_hits++;
+    }
+    else
+    {
+        tc_misses++;
+    }
+    spinlock_release(&tc_lock);
+
+    return frame;
+}
+
+/*
+    Adds the page to the cache, unless another process got there first, the
+    cache is full of pages still in use, or a file may have been changed
+    since the lookup that returned generation. From here on the frame stays
+    resident until the cache lets go of it.
+*/
+void textcache_put(struct as_regions *region, vaddr_t vaddr, vaddr_t frame,
+                   unsigned generation)
+{
+    if (!tc_cacheable(region))
+        return;
+
+    off_t offset;
+    unsigned start, end;
+    tc_key(region, vaddr, &offset, &start, &end);
+
+    struct tc_page *page = kmalloc(sizeof(struct tc_page));
+    if (page == NULL)
+        return;
+
+    struct vnode *drop[TEXTCACHE_FILES];
+    unsigned ndrop = 0;
+    struct tc_file *file = NULL;
+
+    spinlock_acquire(&tc_lock);
+    if (generation == *tc_generation(region->vnode) &&
+        tc_find(region->vnode, offset, start, end) == NULL)
+    {
+        if (tc_npages == TEXTCACHE_MAXPAGES)
+            tc_evict_idle(1, drop, &ndrop);
+        if (tc_npages < TEXTCACHE_MAXPAGES)
+            file = tc_file_get(region->vnode);
+    }
+
+    if (file != NULL)
+    {
+        page->file = file;
+        page->offset = offset;
+        page->start = start;
+        page->end = end;
+        page->frame = frame;
+
+        struct tc_page **bucket = tc_bucket(file->vnode, offset);
+        page->next = *bucket;
+        *bucket = page;
+        page->file_next = file->pages;
+        file->pages = page;
+        file->npages++;
+        tc_npages++;
+
+        ref_kpage(frame);
+        frame_keep_resident(frame);
+        page = NULL;
+    }
+    spinlock_release(&tc_lock);
+
+    tc_drop(drop, ndrop);
+    if (page != NULL)
+        kfree(page);
+}
+
+/*
+    Called before and after the file is written to or truncated, so that
+    processes that start running it afterwards read the new contents. The
+    first call keeps the old pages from being handed out while the file is
+    changing; the second drops any read meanwhile, and the generation keeps
+    pages read before it from being added after. Processes already running
+    keep the frames they map. Devices, the console among them, are never
+    executables, so writes to them are let through without the lock.
+*/
+void textcache_invalidate(struct vnode *vn)
+{
+    struct vnode *drop[TEXTCACHE_FILES];
+    unsigned ndrop = 0;
+
+    if (vn->vn_fs == NULL)
+        return;
+
+    spinlock_acquire(&tc_lock);
+    (*tc_generation(vn))++;
+    for (unsigned i = 0; i < TEXTCACHE_FILES; i++)
+    {
+        struct tc_file *file = &tc_files[i];
+        if (file->vnode != vn)
+            continue;
+        while (file->vnode == vn && file->pages != NULL)
+            tc_remove(file->pages, drop, &ndrop);
+        break;
+    }
+    spinlock_release(&tc_lock);
+
+    tc_drop(drop, ndrop);
+}
+
+/*
+    Called when frames run out, before anything is paged out.
+*/
+unsigned textcache_reclaim(void)
+{
+    struct vnode *drop[TEXTCACHE_FILES];
+    unsigned ndrop = 0;
+
+    spinlock_acquire(&tc_lock);
+    unsigned evicted = tc_evict_idle(TEXTCACHE_MAXPAGES, drop, &ndrop);
+    spinlock_release(&tc_lock);
+
+    tc_drop(drop, ndrop);
+    return evicted;
+}
+
+void textcache_printstats(void)
+{
+    unsigned nfiles = 0;
+
+    spinlock_acquire(&tc_lock);
+    for (unsigned i = 0; i < TEXTCACHE_FILES; i++)
+    {
+        if (tc_files[i].vnode != NULL)
+            nfiles++;
+    }
+    unsigned npages = tc_npages;
+    unsigned hits = tc_hits;
+    unsigned misses = tc_misses;
+    spinlock_release(&tc_lock);
+
+    kprintf("text cache: %u pages of %u executables cached, at most %u\n",
+            npages, nfiles, TEXTCACHE_MAXPAGES);
+    kprintf("text cache: %u of %u faults on read-only segments shared a page\n",
+            hits, hits + misses);
+}
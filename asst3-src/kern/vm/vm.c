@@ -3,51 +3,61 @@
 #include <lib.h>
 #include <spl.h>
 #include <thread.h>
+#include <current.h>
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
 #include <machine/tlb.h>
 #include <proc.h>
+#include <uio.h>
+#include <vnode.h>
+#include <swap.h>
+#include <zeropool.h>
+#include <textcache.h>
+#include <spinlock.h>
+#include <pagetable.h>
+#include <vmstats.h>
+#include "opt-twolevelpt.h"
+#include "opt-invertedpt.h"
 
-/* Place your page table functions here */
-uint32_t HPT_SIZE = 0;
+/*
+    The page table backend, chosen when the kernel is configured (see
+    pagetable.h). Everything below goes through it.
+*/
+#if OPT_TWOLEVELPT && OPT_INVERTEDPT
+#error "options twolevelpt and invertedpt cannot both be set"
+#endif
+
+#if OPT_TWOLEVELPT
+const struct pagetable_ops *const pagetable = &twolevel_pagetable;
+#elif OPT_INVERTEDPT
+const struct pagetable_ops *const pagetable = &inverted_pagetable;
+#else
+const struct pagetable_ops *const pagetable = &hashed_pagetable;
+#endif
 
 /*
-    Initializes the hash page table (HPT) by calculating its size,
-    allocating memory for it, and initializing each entry.
+    Locks the page table entry for the given address space and virtual
+    address. The entry may only be looked up or changed while the lock is
+    held.
 */
-void hpt_init(void)
+void hpt_lock(struct addrspace *as, vaddr_t vaddr)
 {
-    // Get the total size of physical memory
-    paddr_t ram_size = ram_getsize();
-
-    // Calculate the size of the hash page table and allocate memory for it
-    HPT_SIZE = (ram_size / PAGE_SIZE) * 2;
-    hpt = (struct hpt_entry *)kmalloc(sizeof(struct hpt_entry) * HPT_SIZE);
+    pagetable->pt_lock(as, vaddr);
+}
 
-    // Initialize each hash page table entry
-    for (uint32_t i = 0; i < HPT_SIZE; i++)
-    {
-        hpt[i].pid = 0;     // The process ID for this entry
-        hpt[i].entrylo = 0; // The entrylo register for this entry
-        hpt[i].entryhi = 0; // The entryhi register for this entry
-        hpt[i].next = NULL; // Pointer to next entry in case of collision
-    }
+void hpt_unlock(struct addrspace *as, vaddr_t vaddr)
+{
+    pagetable->pt_unlock(as, vaddr);
 }
 
 /*
-    Computes the hash index for the given address space and virtual address.
+    Prints which page table backend is in use and how well it is doing.
 */
-uint32_t hpt_hash(struct addrspace *as, vaddr_t address)
+void hpt_printstats(void)
 {
-    // Make sure the address is aligned to a page boundary.
-    KASSERT((address & PAGE_FRAME) == address);
-
-    // Calculate the hash index by combining the address space pointer and
-    // the high-order bits of the address. The resulting value is modulo the
-    // hash table size.
-    uint32_t index = (((uint32_t)as) ^ (address >> 12)) % HPT_SIZE;
-    return index;
+    kprintf("vm: %s page table\n", pagetable->pt_name);
+    pagetable->pt_printstats();
 }
 
 /*
@@ -61,226 +71,927 @@ void zero_pad(paddr_t paddr, unsigned npages)
 }
 
 /*
-    Adds a new page table entry to the hash page table for the given address space,
-    virtual address, and write permissions. Optionally writes the new entry to the TLB.
-*/
-int hpt_add(struct addrspace *as, vaddr_t vaddr, int permissions, bool write_to_tlb)
-{
-    // Ensure `as` and `vaddr` are not NULL
-    KASSERT(as && vaddr);
-    vaddr &= PAGE_FRAME;
-    vaddr_t paddr = alloc_kpages(1);
+    Each address space keeps a list of the pages it has entries for (resident
+    or in swap), in no particular order, so that hpt_free(), hpt_copy() and
+    hpt_writeback() visit only the pages that exist rather than looking up
+    every page of a region. Only the thread running in the address space adds
+    and removes pages (processes are single-threaded), or the thread creating
+    or destroying it, so the list needs no lock of its own.
 
-    if (!paddr)
-        return ENOMEM; // out of frames
-    KASSERT(paddr % PAGE_SIZE == 0);
+    The list is kept in chunks of at most a page, so growing it on the fault
+    path never needs contiguous frames, which are the first thing to run out
+    when memory is full. The first chunk starts small and doubles up to a
+    page; after that whole-page chunks are added, and only the small array
+    of chunk pointers is copied to grow.
+*/
+#define HPT_PAGECHUNK (PAGE_SIZE / sizeof(vaddr_t)) // pages listed per chunk
 
-    uint32_t index = hpt_hash(as, vaddr);
-    uint32_t curr_index = index;
+static vaddr_t *hpt_page(struct addrspace *as, unsigned i)
+{
+    KASSERT(i < as->maxpages);
+    return &as->pages[i / HPT_PAGECHUNK][i % HPT_PAGECHUNK];
+}
 
-    struct hpt_entry *entry = &hpt[curr_index];
+/*
+    Makes room in the list for one more page (see hpt_reserve()).
+*/
+static int hpt_pages_reserve(struct addrspace *as)
+{
+    if (as->npages < as->maxpages)
+        return 0;
 
-    // find the first invalid entry
-    while (entry->entrylo & TLBLO_VALID)
+    if (as->maxpages < HPT_PAGECHUNK)
     {
-        curr_index = (curr_index + 1) % HPT_SIZE;
-
-        if (curr_index == index)
+        unsigned maxpages = as->maxpages ? as->maxpages * 2 : 16;
+        if (as->pages == NULL)
         {
-            free_kpages(paddr);
-            return ENOMEM; // No invalid entry found, return error
+            as->pages = kmalloc(sizeof(vaddr_t *));
+            if (as->pages == NULL)
+                return ENOMEM;
+            as->pages[0] = NULL;
+            as->maxchunks = 1;
         }
 
-        entry = &hpt[curr_index];
+        vaddr_t *chunk = kmalloc(maxpages * sizeof(vaddr_t));
+        if (chunk == NULL)
+            return ENOMEM;
+        if (as->npages)
+            memcpy(chunk, as->pages[0], as->npages * sizeof(vaddr_t));
+        kfree(as->pages[0]);
+        as->pages[0] = chunk;
+        as->maxpages = maxpages;
+        return 0;
     }
 
-    // internal collision based on the initial hashed index
-    struct hpt_entry *curr_entry = &hpt[index];
-    if (curr_entry->entrylo & TLBLO_VALID)
+    unsigned nchunks = as->maxpages / HPT_PAGECHUNK;
+    if (nchunks == as->maxchunks)
     {
-        while (curr_entry->next)
-            curr_entry = curr_entry->next;
-        curr_entry->next = entry;
+        vaddr_t **chunks = kmalloc(nchunks * 2 * sizeof(vaddr_t *));
+        if (chunks == NULL)
+            return ENOMEM;
+        memcpy(chunks, as->pages, nchunks * sizeof(vaddr_t *));
+        kfree(as->pages);
+        as->pages = chunks;
+        as->maxchunks = nchunks * 2;
     }
 
-    // zero pad the page
-    zero_pad(paddr, 1);
+    as->pages[nchunks] = kmalloc(PAGE_SIZE);
+    if (as->pages[nchunks] == NULL)
+        return ENOMEM;
+    as->maxpages += HPT_PAGECHUNK;
+    return 0;
+}
+
+/*
+    Frees the chunks of an empty page list, all of them, or all but the first
+    if keep_first is set, for an address space that goes back to its cache.
+*/
+void hpt_pages_destroy(struct addrspace *as, bool keep_first)
+{
+    KASSERT(as->npages == 0);
+
+    if (as->pages == NULL)
+        return;
+
+    for (unsigned i = keep_first ? 1 : 0; i * HPT_PAGECHUNK < as->maxpages; i++)
+        kfree(as->pages[i]);
+
+    if (keep_first && as->maxpages > 0)
+    {
+        if (as->maxpages > HPT_PAGECHUNK)
+            as->maxpages = HPT_PAGECHUNK;
+        return;
+    }
+
+    kfree(as->pages);
+    as->pages = NULL;
+    as->maxpages = 0;
+    as->maxchunks = 0;
+}
+
+/*
+    Prepares for hpt_insert() of an entry for the given page: makes room in
+    the page list and has the backend allocate anything it will need. Called
+    before taking the entry's lock, which must not be held while allocating.
+*/
+static int hpt_reserve(struct addrspace *as, vaddr_t vaddr)
+{
+    int ret = hpt_pages_reserve(as);
+    if (ret)
+        return ret;
+
+    if (pagetable->pt_reserve == NULL)
+        return 0;
+    return pagetable->pt_reserve(as, vaddr);
+}
+
+/*
+    Inserts an entry for the given address space and (page-aligned) virtual
+    address into the page table, and adds the page to the address space's
+    list. Returns NULL if the page table has no room for it. The caller has
+    called hpt_reserve() first, and holds the entry's lock.
+*/
+static struct pte *hpt_insert(struct addrspace *as, vaddr_t vaddr, uint32_t entrylo)
+{
+    struct pte *entry = pagetable->pt_insert(as, vaddr, entrylo);
+    if (entry == NULL)
+        return NULL;
 
-    entry->pid = (uint32_t)as;
-    entry->entryhi = vaddr;
-    entry->entrylo = KVADDR_TO_PADDR(paddr) | TLBLO_VALID;
-    entry->next = NULL;
+    KASSERT(as->npages < as->maxpages);
+    *hpt_page(as, as->npages++) = vaddr;
+
+    return entry;
+}
+
+/*
+    Loads an entry into the TLB, replacing any stale entry for the same
+    virtual page (e.g. the read-only mapping of a copy-on-write page).
+    entryhi carries the address space ID (see as_tlb_entryhi()).
+*/
+static void tlb_update(uint32_t entryhi, uint32_t entrylo)
+{
+    int spl = splhigh();
+    int index = tlb_probe(entryhi, 0);
+    if (index >= 0)
+        tlb_write(entryhi, entrylo, index);
+    else
+        tlb_random(entryhi, entrylo);
+    splx(spl);
+}
+
+/*
+    Enters the frame at paddr (a kernel address) in the page table at vaddr,
+    writeable if the permissions include WRITE. The reference to the frame
+    passes to the new entry; if there is no room for one, it is dropped.
+*/
+static int hpt_map(struct addrspace *as, vaddr_t vaddr, vaddr_t paddr, int permissions)
+{
+    uint32_t entrylo = KVADDR_TO_PADDR(paddr) | TLBLO_VALID;
 
     // set TLB_LODIRTY if writeable
     if (permissions & WRITE)
-        entry->entrylo |= TLBLO_DIRTY;
+        entrylo |= TLBLO_DIRTY;
+
+    if (hpt_reserve(as, vaddr))
+    {
+        free_kpages(paddr);
+        return ENOMEM;
+    }
 
-    // new tlb entry
-    if (write_to_tlb)
+    hpt_lock(as, vaddr);
+    struct pte *entry = hpt_insert(as, vaddr, entrylo);
+    hpt_unlock(as, vaddr);
+    if (entry == NULL)
     {
-        int spl = splhigh();
-        tlb_random(entry->entryhi, entry->entrylo);
-        splx(spl);
+        free_kpages(paddr);
+        return ENOMEM;
     }
+    return 0;
+}
 
+/*
+    Adds a new page table entry to the page table for the given address space,
+    virtual address, and write permissions. The new zeroed frame is handed back
+    pinned in *frame; the caller unpins it once the page is ready for use.
+*/
+int hpt_add(struct addrspace *as, vaddr_t vaddr, int permissions, vaddr_t *frame)
+{
+    // Ensure `as` and `vaddr` are not NULL
+    KASSERT(as && vaddr);
+    vaddr &= PAGE_FRAME;
+
+    // take a frame zeroed in the background if there is one
+    vaddr_t paddr = zeropool_get();
+    if (paddr)
+    {
+        frame_set_owner(paddr, as, vaddr);
+        VMSTAT_INC(vs_zeropool);
+    }
+    else
+    {
+        paddr = alloc_upage(as, vaddr);
+        if (!paddr)
+            return ENOMEM; // out of frames
+
+        // zero pad the page
+        zero_pad(paddr, 1);
+    }
+    VMSTAT_INC(vs_zerofills);
+    KASSERT(paddr % PAGE_SIZE == 0);
+
+    int ret = hpt_map(as, vaddr, paddr, permissions);
+    if (ret)
+        return ret;
+
+    *frame = paddr;
     return 0;
 }
 
 /*
-    Retrieves the page table entry for the given address space and virtual address.
-    Also returns the previous entry in the collision chain if requested.
+    Retrieves the page table entry for the given address space and virtual
+    address, or NULL if it has none. The caller holds the entry's lock (see
+    hpt_lock()).
 */
-struct hpt_entry *hpt_get(struct addrspace *as, vaddr_t vaddr, struct hpt_entry **prev_entry)
+struct pte *hpt_get(struct addrspace *as, vaddr_t vaddr)
 {
     // Ensure that the virtual address is page-aligned
     KASSERT((vaddr & PAGE_FRAME) == vaddr);
 
-    // Hash the address and get the process ID
-    uint32_t index = hpt_hash(as, vaddr);
-    pid_t pid = (uint32_t)as;
+    VMSTAT_INC(vs_ptlookups);
+    return pagetable->pt_get(as, vaddr);
+}
 
-    // Start at the hashed index and search the linked list of entries for a match
-    struct hpt_entry *curr_entry = &hpt[index];
-    while (curr_entry != NULL)
+/*
+    Moves the part of a file-backed region that falls within the page at vaddr
+    between the file and the frame at kvaddr: reads it into the (already
+    zeroed) frame, or writes it back to the file.
+*/
+static int region_io(struct as_regions *region, vaddr_t vaddr, vaddr_t kvaddr, enum uio_rw rw)
+{
+    KASSERT(region->vnode != NULL);
+    KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+    vaddr_t file_end = region->file_vaddr + region->file_size;
+    vaddr_t start = vaddr > region->file_vaddr ? vaddr : region->file_vaddr;
+    vaddr_t end = vaddr + PAGE_SIZE < file_end ? vaddr + PAGE_SIZE : file_end;
+
+    // page lies entirely in the zero-filled part of the region
+    if (start >= end)
+        return 0;
+
+    struct iovec iov;
+    struct uio ku;
+    uio_kinit(&iov, &ku, (void *)(kvaddr + (start - vaddr)), end - start,
+              region->file_offset + (start - region->file_vaddr), rw);
+
+    int result;
+    if (rw == UIO_READ)
     {
-        // If the entry matches the virtual address, process ID, and is valid, break out of the loop
-        if ((curr_entry->entryhi & TLBHI_VPAGE) == vaddr &&
-            pid == curr_entry->pid &&
-            (curr_entry->entrylo & TLBLO_VALID))
-            break;
-        if (prev_entry)
-            *prev_entry = curr_entry;
-        curr_entry = curr_entry->next;
+        result = VOP_READ(region->vnode, &ku);
     }
+    else
+    {
+        textcache_invalidate(region->vnode);
+        result = VOP_WRITE(region->vnode, &ku);
+        textcache_invalidate(region->vnode);
+    }
+    if (result)
+        return result;
 
-    // Return the matching entry, or NULL if no match was found
-    return curr_entry;
+    if (ku.uio_resid != 0)
+    {
+        if (region->type != REGION_SEGMENT)
+            return EIO; // mapped file was truncated
+
+        /* short read; problem with executable? */
+        kprintf("ELF: short read on segment - file truncated?\n");
+        return ENOEXEC;
+    }
+
+    return 0;
 }
 
 /*
-    Copies the page table entries and their associated pages
-    from the old address space to the new address space for the given memory region.
+    The permissions to enter a new page of the region with. Pages of shared
+    file mappings are entered read-only unless written, so that
+    hpt_writeback() can tell which ones were changed.
 */
-int hpt_copy(struct as_regions *region, struct addrspace *old, struct addrspace *newas)
+static int region_permissions(struct as_regions *region, int faulttype)
 {
-    vaddr_t addr = region->base;
-    vaddr_t end = region->base + region->size;
-    while (addr != end)
-    {
-        // Get the page table entry for the address in the old addrspace.
-        struct hpt_entry *entry = hpt_get(old, addr, NULL);
-        if (entry != NULL)
-        { // found a page entry
+    if (region->type == REGION_SHARED && region->vnode != NULL &&
+        faulttype == VM_FAULT_READ)
+        return region->permissions & ~WRITE;
+    return region->permissions;
+}
 
-            // Add a new page entry to the new addrspace with the same address and permissions as the old entry.
-            int ret = hpt_add(newas, addr, region->permissions, false);
-            if (ret)
-                return ret;
+/*
+    The frames of a shared mapping that was copied into a child, shared by
+    the regions of every copy of it, so that a page first touched by one of
+    the processes after the fork is found by the others rather than each
+    getting a frame of its own. It holds a reference to each frame and, like
+    the text cache, keeps it resident; pages of a mapping that was never
+    copied are paged as usual.
+*/
+struct region_share {
+    struct spinlock lock;
+    unsigned refcount;          // regions using it
+    unsigned npages;
+    vaddr_t *frames;            // 0 for pages none of them has touched yet
+};
 
-            // Get the new page entry to copy the page contents to.
-            struct hpt_entry *new_entry = hpt_get(newas, addr, NULL);
-            if (new_entry == NULL)
-                return ENOMEM;
+/*
+    Makes the copy of a shared mapping in a child use the same frames as the
+    original, starting to track them if this is the mapping's first copy. The
+    pages the original has already are added by hpt_copy().
+*/
+int hpt_share(struct as_regions *region, struct as_regions *copy)
+{
+    KASSERT(region->type == REGION_SHARED && copy->share == NULL);
 
-            // Copy the contents of the old page to the new page.
-            vaddr_t old_frame = PADDR_TO_KVADDR(entry->entrylo & TLBLO_PPAGE);
-            vaddr_t new_frame = PADDR_TO_KVADDR(new_entry->entrylo & TLBLO_PPAGE);
-            memmove((void *)new_frame, (const void *)old_frame, PAGE_SIZE);
+    struct region_share *share = region->share;
+    if (share == NULL)
+    {
+        share = kmalloc(sizeof(struct region_share));
+        if (share == NULL)
+            return ENOMEM;
+        share->npages = region->size / PAGE_SIZE;
+        share->frames = kmalloc(share->npages * sizeof(vaddr_t));
+        if (share->frames == NULL)
+        {
+            kfree(share);
+            return ENOMEM;
         }
-        addr += PAGE_SIZE;
+        for (unsigned i = 0; i < share->npages; i++)
+            share->frames[i] = 0;
+        spinlock_init(&share->lock);
+        share->refcount = 1;
+        region->share = share;
     }
+
+    spinlock_acquire(&share->lock);
+    share->refcount++;
+    spinlock_release(&share->lock);
+    copy->share = share;
     return 0;
 }
 
-void set_page_write_permissions(struct addrspace *as, vaddr_t vaddr, uint32_t memsize)
+/*
+    Lets go of the region's share of its mapping's frames, once its own page
+    table entries are gone. The last region to do so releases them.
+*/
+void hpt_unshare(struct as_regions *region)
 {
-    for (vaddr_t addr = vaddr; addr != vaddr + memsize; addr += PAGE_SIZE)
+    struct region_share *share = region->share;
+    if (share == NULL)
+        return;
+    region->share = NULL;
+
+    spinlock_acquire(&share->lock);
+    bool last = --share->refcount == 0;
+    spinlock_release(&share->lock);
+    if (!last)
+        return;
+
+    for (unsigned i = 0; i < share->npages; i++)
     {
-        addr &= PAGE_FRAME;
-        // Get the page table entry for the address
-        struct hpt_entry *entry = hpt_get(as, addr, NULL);
-        if (entry)
+        if (share->frames[i] == 0)
+            continue;
+        frame_allow_paging(share->frames[i]);
+        free_kpages(share->frames[i]);
+    }
+    spinlock_cleanup(&share->lock);
+    kfree(share->frames);
+    kfree(share);
+}
+
+/*
+    Returns the frame the mapping's copies share at vaddr, with a reference
+    taken for the caller, or 0 if none of them has touched the page yet.
+*/
+static vaddr_t share_get(struct as_regions *region, vaddr_t vaddr)
+{
+    struct region_share *share = region->share;
+    unsigned i = (vaddr - region->base) / PAGE_SIZE;
+    KASSERT(i < share->npages);
+
+    spinlock_acquire(&share->lock);
+    vaddr_t frame = share->frames[i];
+    if (frame)
+        ref_kpage(frame);
+    spinlock_release(&share->lock);
+    return frame;
+}
+
+/*
+    Offers the frame just given to the page at vaddr to the mapping's other
+    copies. Returns the frame they share there: this one, which the share
+    takes a reference to unless it has it already, or the one another
+    process got in first with, which is returned with a reference taken for
+    the caller.
+*/
+static vaddr_t share_put(struct as_regions *region, vaddr_t vaddr, vaddr_t frame)
+{
+    struct region_share *share = region->share;
+    unsigned i = (vaddr - region->base) / PAGE_SIZE;
+    KASSERT(i < share->npages);
+
+    spinlock_acquire(&share->lock);
+    vaddr_t shared = share->frames[i];
+    if (shared != frame)
+    {
+        if (shared == 0)
         {
-            // If the page table entry exists, update the permissions and write to the TLB
-            paddr_t paddr = entry->entrylo & TLBLO_PPAGE;
-            entry->entrylo |= TLBLO_DIRTY | TLBLO_VALID;
-            int spl = splhigh(); // Disable interrupts
-            tlb_write(addr, paddr, entry->entrylo); // Write the updated entry to the TLB
-            splx(spl); // Re-enable interrupts
+            shared = share->frames[i] = frame;
+            frame_keep_resident(frame);
         }
+        ref_kpage(shared);
     }
+    spinlock_release(&share->lock);
+    return shared;
 }
 
-void reset_page_write_permissions(struct addrspace *as, vaddr_t vaddr, uint32_t memsize)
+/*
+    Gives the page at vaddr in the region a new frame, filled from the region's
+    file if it has one. The frame is handed back pinned in *frame, as with
+    hpt_add(). Pages of executables that cannot be written are shared through
+    the text cache, and are only read from the file by the first process to
+    touch them. Likewise pages of shared mappings copied by a fork are shared
+    by all of the copies (see hpt_share()).
+*/
+static int region_newpage(struct addrspace *as, struct as_regions *region, vaddr_t vaddr,
+                          int permissions, vaddr_t *frame)
 {
-    for (vaddr_t addr = vaddr; addr != vaddr + memsize; addr += PAGE_SIZE)
+    unsigned generation = 0;
+    vaddr_t cached = region->share != NULL ? share_get(region, vaddr) :
+                                             textcache_get(region, vaddr, &generation);
+    if (cached)
     {
-        addr &= PAGE_FRAME;
-        struct hpt_entry *entry = hpt_get(as, addr, NULL);
-        if (entry)
+        // never paged out, so there is nothing to pin
+        int ret = hpt_map(as, vaddr, cached, permissions);
+        if (ret)
+            return ret;
+        *frame = cached;
+        return 0;
+    }
+
+    int ret = hpt_add(as, vaddr, permissions, frame);
+    if (ret)
+        return ret;
+
+    if (region->vnode)
+    {
+        ret = region_io(region, vaddr, *frame, UIO_READ);
+        if (ret)
         {
-            paddr_t paddr = entry->entrylo & TLBLO_PPAGE;
-            entry->entrylo &= ~TLBLO_DIRTY;
-            int spl = splhigh();
-            tlb_write(addr, paddr, entry->entrylo);
-            splx(spl);
+            hpt_free(as, vaddr, PAGE_SIZE);
+            return ret;
         }
+        textcache_put(region, vaddr, *frame, generation);
     }
+
+    if (region->share != NULL)
+    {
+        vaddr_t shared = share_put(region, vaddr, *frame);
+        if (shared != *frame)
+        {
+            // another process got there first; use its frame instead
+            hpt_free(as, vaddr, PAGE_SIZE);
+            ret = hpt_map(as, vaddr, shared, permissions);
+            if (ret)
+                return ret;
+            *frame = shared;
+        }
+    }
+    return 0;
 }
 
 /*
-    Frees the page table entries and associated pages for the specified memory region in the given address space.
+    Shares one page of the region with the new address space (see hpt_copy()).
+*/
+static int hpt_copy_page(struct as_regions *region, struct addrspace *old,
+                         struct addrspace *newas, vaddr_t addr)
+{
+    // Get the page table entry for the address in the old addrspace.
+    hpt_lock(old, addr);
+    struct pte *entry = hpt_get(old, addr);
+
+    // Only resident frames can be shared, so bring back swapped pages.
+    while (entry != NULL && entry->swapped)
+    {
+        hpt_unlock(old, addr);
+        int ret = hpt_swapin(old, addr);
+        if (ret)
+            return ret;
+        hpt_lock(old, addr);
+        entry = hpt_get(old, addr);
+    }
+
+    if (entry == NULL)
+    {
+        hpt_unlock(old, addr);
+        return 0;
+    }
+
+    // Revoke write access in the parent; the caller flushes its TLB.
+    // Pages of shared mappings stay shared, writes and all.
+    if (region->type != REGION_SHARED)
+        entry->entrylo &= ~TLBLO_DIRTY;
+
+    // Take a reference to the frame while the parent's entry is locked,
+    // so the pager sees it shared and leaves it alone from here on.
+    uint32_t entrylo = entry->entrylo;
+    vaddr_t frame = PADDR_TO_KVADDR(entrylo & TLBLO_PPAGE);
+    ref_kpage(frame);
+    if (region->share != NULL)
+    {
+        // the parent's pages went into the share when it was first copied,
+        // or were found there since; only those are left to add
+        vaddr_t shared = share_put(region, addr, frame);
+        KASSERT(shared == frame);
+    }
+    hpt_unlock(old, addr);
+
+    // Map the same frame into the new addrspace.
+    if (hpt_reserve(newas, addr))
+    {
+        free_kpages(frame);
+        return ENOMEM;
+    }
+    hpt_lock(newas, addr);
+    entry = hpt_insert(newas, addr, entrylo);
+    hpt_unlock(newas, addr);
+    if (entry == NULL)
+    {
+        free_kpages(frame);
+        return ENOMEM;
+    }
+    VMSTAT_INC(vs_forkshared);
+    return 0;
+}
+
+/*
+    Shares the page table entries of the old address space with the new address
+    space for the given memory region. Frames are not copied: both address spaces
+    map the same frame read-only and the first write to it faults into
+    hpt_cow_break(), which gives the writer its own copy. Shared mappings are
+    the exception; both keep writing to the same frame. Their pages are also
+    added to the mapping's share (see hpt_share()), through which pages not
+    touched yet are shared when one of the processes first does, so they
+    never end up with frames of their own.
+*/
+int hpt_copy(struct as_regions *region, struct addrspace *old, struct addrspace *newas)
+{
+    int ret;
+
+    // only the pages the old addrspace has; none are added to it meanwhile
+    for (unsigned i = 0; i < old->npages; i++)
+    {
+        vaddr_t addr = *hpt_page(old, i);
+        if (addr < region->base || addr - region->base >= region->size)
+            continue;
+        ret = hpt_copy_page(region, old, newas, addr);
+        if (ret)
+            return ret;
+    }
+    return 0;
+}
+
+/*
+    Gives the faulting address space a private, writeable copy of a page that
+    is shared copy-on-write. If no one else maps the frame any more it is simply
+    made writeable again.
+*/
+int hpt_cow_break(struct addrspace *as, vaddr_t vaddr)
+{
+    hpt_lock(as, vaddr);
+    struct pte *entry = hpt_get(as, vaddr);
+    KASSERT(entry && (entry->entrylo & TLBLO_VALID));
+    KASSERT(!(entry->entrylo & TLBLO_DIRTY));
+
+    paddr_t old_paddr = entry->entrylo & TLBLO_PPAGE;
+    vaddr_t old_frame = PADDR_TO_KVADDR(old_paddr);
+
+    if (kpage_refcount(old_frame) == 1)
+    {
+        // Sole user of the frame; make it the frame's owner again, since the
+        // reverse mapping may still name the address space that shared it.
+        frame_set_owner(old_frame, as, vaddr);
+        frame_unpin(old_frame);
+        entry->entrylo |= TLBLO_DIRTY;
+        tlb_update(as_tlb_entryhi(as, vaddr), entry->entrylo);
+        hpt_unlock(as, vaddr);
+        return 0;
+    }
+    hpt_unlock(as, vaddr);
+
+    // May page something out and sleep, so look the entry up again after.
+    vaddr_t new_frame = alloc_upage(as, vaddr);
+    if (!new_frame)
+        return ENOMEM; // out of frames
+
+    hpt_lock(as, vaddr);
+    entry = hpt_get(as, vaddr);
+    if (entry == NULL || !(entry->entrylo & TLBLO_VALID) ||
+        (entry->entrylo & TLBLO_PPAGE) != old_paddr)
+    {
+        // paged out meanwhile; let the write fault again
+        hpt_unlock(as, vaddr);
+        free_kpages(new_frame);
+        return 0;
+    }
+
+    // Copy the contents of the shared page, then drop our reference to it.
+    memmove((void *)new_frame, (const void *)old_frame, PAGE_SIZE);
+    entry->entrylo = KVADDR_TO_PADDR(new_frame) | (entry->entrylo & ~TLBLO_PPAGE) | TLBLO_DIRTY;
+    hpt_unlock(as, vaddr);
+
+    // Other CPUs the address space ran on may still map the old frame, read
+    // only, so it is let go of once they have dropped it. The shootdown has
+    // to wait for them, so it comes after the lock is released; it takes this
+    // CPU's entry too, and the retried write loads the new one.
+    as_tlb_invalidate(as, vaddr);
+    frame_clear_owner(old_frame, as);
+    free_kpages(old_frame);
+    frame_unpin(new_frame);
+    VMSTAT_INC(vs_cowcopies);
+
+    return 0;
+}
+
+/*
+    Brings a page of the given address space back from swap into a new frame.
+*/
+int hpt_swapin(struct addrspace *as, vaddr_t vaddr)
+{
+    hpt_lock(as, vaddr);
+    struct pte *entry = hpt_get(as, vaddr);
+    KASSERT(entry && entry->swapped);
+    uint32_t slot = entry->swap_slot;
+    hpt_unlock(as, vaddr);
+
+    vaddr_t frame = alloc_upage(as, vaddr);
+    if (!frame)
+        return ENOMEM;
+
+    int ret = swap_read(slot, frame);
+    if (ret)
+    {
+        free_kpages(frame);
+        return ret;
+    }
+
+    // The entry may have moved within its chain while we slept.
+    hpt_lock(as, vaddr);
+    entry = hpt_get(as, vaddr);
+    KASSERT(entry && entry->swapped && entry->swap_slot == slot);
+    entry->entrylo = KVADDR_TO_PADDR(frame) | TLBLO_VALID | (entry->entrylo & TLBLO_DIRTY);
+    entry->swapped = false;
+    entry->swap_slot = 0;
+    hpt_unlock(as, vaddr);
+
+    swap_free(slot);
+    frame_unpin(frame);
+    VMSTAT_INC(vs_swapins);
+    return 0;
+}
+
+/*
+    Switches the entry mapping the given frame over to the swap slot, if the
+    frame is still the pager's victim. While it is, as still maps it at vaddr
+    and cannot go away (see frame_evictable()), so the check comes before the
+    entry is looked up; as may already be gone otherwise. The caller holds
+    the entry's lock.
+*/
+static bool hpt_unmap_victim(struct addrspace *as, vaddr_t vaddr,
+                             vaddr_t kvaddr, uint32_t slot)
+{
+    // freed, or shared by a fork, since it was chosen
+    if (!frame_evictable(kvaddr))
+        return false;
+
+    struct pte *entry = hpt_get(as, vaddr);
+    KASSERT(entry != NULL && (entry->entrylo & TLBLO_VALID));
+    KASSERT((entry->entrylo & TLBLO_PPAGE) == KVADDR_TO_PADDR(kvaddr));
+
+    // keep DIRTY so the page comes back with the same write access
+    entry->entrylo &= TLBLO_DIRTY;
+    entry->swapped = true;
+    entry->swap_slot = slot;
+
+    return true;
+}
+
+/*
+    Unmaps the page held in the frame at kvaddr so the pager can write it to the
+    given swap slot. as and vaddr are the frame's reverse mapping; if it is not
+    known (the frame was shared and its owner let go of it) the page table is
+    searched for the one entry that still maps the frame. Its owner cannot use
+    or change the entry while it is locked, and its TLB entries are gone, on
+    every CPU, by the time this returns. Returns false if the frame is no
+    longer the victim chosen by frame_choose_victim() (it is being freed or was
+    shared meanwhile).
+*/
+bool hpt_pageout(struct addrspace *as, vaddr_t vaddr, vaddr_t kvaddr, uint32_t slot)
+{
+    if (as == NULL && !pagetable->pt_find_frame(KVADDR_TO_PADDR(kvaddr), &as, &vaddr))
+        return false;
+
+    hpt_lock(as, vaddr);
+    bool unmapped = hpt_unmap_victim(as, vaddr, kvaddr, slot);
+    hpt_unlock(as, vaddr);
+
+    // The owner may be running on another CPU, which has to be waited for,
+    // so its TLB entry goes after the lock is dropped. Until then it may
+    // still write to the frame, but the frame is only written out after.
+    // The owner cannot go away meanwhile: destroying it would free the
+    // swap slot, which waits for the pager to finish.
+    if (unmapped)
+    {
+        as_tlb_invalidate(as, vaddr);
+        VMSTAT_INC(vs_swapouts);
+    }
+
+    return unmapped;
+}
+
+/*
+    Removes the page table entry for the given page, freeing its frame or swap
+    slot.
+*/
+static void hpt_remove(struct addrspace *as, vaddr_t page)
+{
+    // keep the pager away from the entry while it is removed
+    hpt_lock(as, page);
+
+    struct pte *entry = hpt_get(as, page);
+
+    // every page on the list has an entry
+    KASSERT(entry != NULL);
+
+    // Free the kernel page allocated for the current page's physical address,
+    // or remember the swap slot to release once the entry is gone
+    bool swapped = entry->swapped;
+    uint32_t slot = entry->swap_slot;
+    vaddr_t frame = 0;
+    if (!swapped)
+    {
+        frame = PADDR_TO_KVADDR(entry->entrylo & TLBLO_PPAGE);
+        // Other CPUs may map the frame until the shootdown below, which has
+        // to wait until the lock is released. Hold on to it until then; the
+        // extra reference also keeps the pager from taking it meanwhile.
+        ref_kpage(frame);
+        // others may still share the frame; it is no longer ours
+        frame_clear_owner(frame, as);
+    }
+
+    pagetable->pt_remove(as, page);
+
+    hpt_unlock(as, page);
+
+    if (swapped)
+    {
+        swap_free(slot);
+    }
+    else
+    {
+        as_tlb_invalidate(as, page);
+        // the entry's reference, then ours
+        free_kpages(frame);
+        free_kpages(frame);
+    }
+}
+
+/*
+    Frees the page table entries and associated pages for the specified memory
+    region in the given address space. Only the pages on the address space's
+    list are visited, however large the region.
 */
 void hpt_free(struct addrspace *as, vaddr_t vaddr, uint32_t memsize)
 {
+    unsigned i = 0;
+    while (i < as->npages)
+    {
+        vaddr_t page = *hpt_page(as, i);
+        if (page < vaddr || page - vaddr >= memsize)
+        {
+            i++;
+            continue;
+        }
 
-    for (vaddr_t page = vaddr; page != vaddr + memsize; page += PAGE_SIZE)
+        // move the last page into this slot, and look at it next
+        as->npages--;
+        *hpt_page(as, i) = *hpt_page(as, as->npages);
+        hpt_remove(as, page);
+    }
+}
+
+/*
+    Writes the pages of a shared mapping that changed since they were last
+    written back to its file. Pages of shared mappings are entered without
+    TLBLO_DIRTY until they are first written (see vm_fault()), so DIRTY marks
+    exactly the changed ones; it is cleared again here so the next change is
+    noticed too. Changed pages in swap are brought back to be written.
+*/
+int hpt_writeback(struct addrspace *as, struct as_regions *region)
+{
+    KASSERT(region->type == REGION_SHARED && region->vnode != NULL);
+
+    // pages are only added by faults, which cannot happen meanwhile
+    for (unsigned i = 0; i < as->npages; i++)
     {
-        struct hpt_entry *prev_entry = NULL;
-        struct hpt_entry *entry = hpt_get(as, page, &prev_entry);
+        vaddr_t page = *hpt_page(as, i);
+        if (page < region->base || page - region->base >= region->size)
+            continue;
 
-        // If there is no entry for the current page, skip to the next page
-        if (entry == NULL)
+        hpt_lock(as, page);
+        struct pte *entry = hpt_get(as, page);
+        while (entry != NULL && entry->swapped && (entry->entrylo & TLBLO_DIRTY))
+        {
+            hpt_unlock(as, page);
+            int ret = hpt_swapin(as, page);
+            if (ret)
+                return ret;
+            hpt_lock(as, page);
+            entry = hpt_get(as, page);
+        }
+
+        if (entry == NULL || !(entry->entrylo & TLBLO_DIRTY))
+        {
+            hpt_unlock(as, page);
             continue;
+        }
 
-        KASSERT((entry->entryhi & TLBHI_VPAGE) == page);
+        // Make the page read-only again, and hold a reference to the frame
+        // so the pager leaves it alone while it is being written.
+        entry->entrylo &= ~TLBLO_DIRTY;
+        vaddr_t frame = PADDR_TO_KVADDR(entry->entrylo & TLBLO_PPAGE);
+        ref_kpage(frame);
+        hpt_unlock(as, page);
 
-        // Free the kernel page allocated for the current page's physical address
-        free_kpages(PADDR_TO_KVADDR(entry->entrylo & TLBLO_PPAGE));
+        // Writes through TLB entries still marked dirty are caught once the
+        // shootdown, which cannot be waited for under the lock, is done; the
+        // page is only read for writing back after.
+        as_tlb_invalidate(as, page);
 
-        struct hpt_entry *remove_entry = entry;
-        if (prev_entry != NULL)
+        int ret = region_io(region, page, frame, UIO_WRITE);
+        free_kpages(frame);
+        if (ret)
+            return ret;
+    }
+    return 0;
+}
+
+/*
+    Fault-around: on a TLB miss, also load the TLB entries of up to
+    vm_faultaround_pages resident pages following the faulting one in the
+    same region, so sequential scans do not trap once per page. 0 turns
+    it off. The vs_faultaround count shows how many traps it saves.
+*/
+#define VM_FAULTAROUND_MAX (NUM_TLB / 4)
+
+static unsigned vm_faultaround_pages = 0;
+
+int vm_set_faultaround(unsigned npages)
+{
+    if (npages > VM_FAULTAROUND_MAX)
+        return EINVAL;
+    vm_faultaround_pages = npages;
+    return 0;
+}
+
+void vm_printstats(void)
+{
+    vmstats_print();
+    textcache_printstats();
+    kprintf("vm: fault-around loads up to %u pages\n", vm_faultaround_pages);
+}
+
+/*
+    Preloads the TLB with the resident pages after vaddr in the region.
+    Pages that are paged out, or already in the TLB, are skipped; a page
+    with no entry yet ends the run, since it will need a real fault.
+*/
+static void vm_faultaround(struct addrspace *as, struct as_regions *region, vaddr_t vaddr)
+{
+    unsigned npages = vm_faultaround_pages;
+    unsigned loaded = 0;
+
+    for (unsigned i = 1; i <= npages; i++)
+    {
+        vaddr_t page = vaddr + i * PAGE_SIZE;
+        if (page >= region->base + region->size)
+            break;
+
+        hpt_lock(as, page);
+        struct pte *entry = hpt_get(as, page);
+        if (entry == NULL)
         {
-            prev_entry->next = entry->next;
+            hpt_unlock(as, page);
+            break;
         }
-        else if (entry->next != NULL)
+        if (entry->entrylo & TLBLO_VALID)
         {
-            struct hpt_entry *end_entry = entry;
-            prev_entry = end_entry;
-            // Find the last entry in the chain for the current page's hashed index
-            while (end_entry->next != NULL)
+            // a duplicate entry would be fatal, so probe first
+            uint32_t entryhi = as_tlb_entryhi(as, page);
+            int spl = splhigh();
+            if (tlb_probe(entryhi, 0) < 0)
             {
-                prev_entry = end_entry;
-                end_entry = end_entry->next;
+                tlb_random(entryhi, entry->entrylo);
+                loaded++;
             }
-
-            // Replace the current page's entry with the last entry in the chain
-            entry->pid = end_entry->pid;
-            entry->entryhi = end_entry->entryhi;
-            entry->entrylo = end_entry->entrylo;
-            remove_entry = end_entry;
-            prev_entry->next = NULL; // removing the last entry
+            splx(spl);
         }
-
-        // Clear the removed entry's fields
-        remove_entry->pid = 0;
-        remove_entry->entryhi = 0;
-        remove_entry->entrylo = 0;
+        hpt_unlock(as, page);
     }
+
+    if (loaded)
+        VMSTAT_ADD(vs_faultaround, loaded);
 }
 
 /*
-    Initializes the virtual memory subsystem by calling the hpt_init function.
+    Initializes the virtual memory subsystem: swap, the address space
+    caches, then the page table, which the inverted backend sizes by swap,
+    then the pool of zeroed frames.
 */
 void vm_bootstrap(void)
 {
@@ -289,43 +1000,42 @@ void vm_bootstrap(void)
      * You may or may not need to add anything here depending what's
      * provided or required by the assignment spec.
      */
-    hpt_init();
+    swap_bootstrap();
+    as_bootstrap();
+    pagetable->pt_bootstrap();
+    zeropool_bootstrap();
 }
 
 /*
     Handles virtual memory faults by checking the fault type and address,
-    validating the address space and region, and either adding a new page table entry or updating the TLB with an existing one.
+    validating the address space and region, and either adding a new page table entry,
+    paging the page back in, breaking copy-on-write sharing, or updating the TLB
+    with an existing entry.
 */
 int vm_fault(int faulttype, vaddr_t faultaddress)
 {
     struct addrspace *as = proc_getas();
-    // check valid region
-    if (as->regions == NULL)
+    if (as == NULL)
         return EFAULT;
 
+    VMSTAT_INC(vs_faults);
+
     // check permissions
-    if (faulttype == VM_FAULT_READONLY)
-        return EFAULT;
-    if (!(faulttype == VM_FAULT_READ || faulttype == VM_FAULT_WRITE))
+    if (!(faulttype == VM_FAULT_READ || faulttype == VM_FAULT_WRITE ||
+          faulttype == VM_FAULT_READONLY))
         return EINVAL;
 
-    
-    struct as_regions *found_region = NULL;
-
     // Align fault address to a page boundary
     faultaddress &= PAGE_FRAME;
 
-    // Iterate through regions to find the one that contains the fault address
-    for (struct as_regions *region = as->regions; region != NULL; region = region->next)
-    {
-        KASSERT((region->base & PAGE_FRAME) == region->base); // ensure aligned to page boundary
-        if (!found_region && faultaddress >= region->base && faultaddress < region->base + region->size)
-        {
-            found_region = region;
-        }
-    }
+    // Find the region that contains the fault address; just below the
+    // stack and near the stack pointer, the stack may grow to take it in
+    struct as_regions *found_region = as_find_region(as, faultaddress);
+    if (!found_region)
+        found_region = as_grow_stack(as, faultaddress, curthread->t_usersp);
     if (!found_region)
         return EFAULT;
+    KASSERT((found_region->base & PAGE_FRAME) == found_region->base); // ensure aligned to page boundary
 
     // Check if the fault type is allowed by the region permissions
     if (faulttype == VM_FAULT_READ && !(found_region->permissions & READ))
@@ -337,36 +1047,93 @@ int vm_fault(int faulttype, vaddr_t faultaddress)
         return EFAULT;
     }
 
-
+    hpt_lock(as, faultaddress);
 
     // Get the corresponding page table entry for the fault address
-    struct hpt_entry *entry = hpt_get(as, faultaddress, NULL);
+    struct pte *entry = hpt_get(as, faultaddress);
 
-    // If no entry was found, create a new entry in the page table and update the TLB
-    if (!entry)
+    // If the page was paged out, bring it back in and start over
+    if (entry && entry->swapped)
     {
-        int ret = hpt_add(as, faultaddress, found_region->permissions, true);
+        hpt_unlock(as, faultaddress);
+        int ret = hpt_swapin(as, faultaddress);
         if (ret)
             return ret;
+        return 0; // the access faults again and finds the page resident
     }
-    else
+
+    // A write to a read-only mapping in a writeable region: the page is
+    // shared copy-on-write, so break the sharing.
+    if (faulttype == VM_FAULT_READONLY)
+    {
+        if (!entry)
+        {
+            hpt_unlock(as, faultaddress);
+            return EFAULT;
+        }
+        if (entry->entrylo & TLBLO_DIRTY)
+        {
+            // stale read-only TLB entry; the page is already private
+            tlb_update(as_tlb_entryhi(as, faultaddress), entry->entrylo);
+            hpt_unlock(as, faultaddress);
+            return 0;
+        }
+        if (found_region->type == REGION_SHARED)
+        {
+            // first write to a page of a shared mapping since it was last
+            // written back; it is not copied, just marked changed
+            entry->entrylo |= TLBLO_DIRTY;
+            tlb_update(as_tlb_entryhi(as, faultaddress), entry->entrylo);
+            hpt_unlock(as, faultaddress);
+            return 0;
+        }
+        hpt_unlock(as, faultaddress);
+        return hpt_cow_break(as, faultaddress);
+    }
+
+    // If an entry already exists, update the TLB with the entry
+    if (entry)
     {
-        // If an entry already exists, update the TLB with the entry
-        int spl = splhigh();
-        tlb_random(entry->entryhi, entry->entrylo);
-        splx(spl);
+        VMSTAT_INC(vs_refills);
+        frame_touch(PADDR_TO_KVADDR(entry->entrylo & TLBLO_PPAGE));
+        tlb_random(as_tlb_entryhi(as, faultaddress), entry->entrylo);
+        hpt_unlock(as, faultaddress);
+        vm_faultaround(as, found_region, faultaddress);
+        return 0;
     }
+    hpt_unlock(as, faultaddress);
+    VMSTAT_INC(vs_firsttouch);
+
+    // No entry was found: create a new entry in the page table, fill it from
+    // the backing file if there is one, and update the TLB. The frame stays
+    // pinned until then, so it cannot be paged out half-filled.
+    vaddr_t frame;
+    int ret = region_newpage(as, found_region, faultaddress,
+                             region_permissions(found_region, faulttype), &frame);
+    if (ret)
+        return ret;
+
+    hpt_lock(as, faultaddress);
+    entry = hpt_get(as, faultaddress);
+    KASSERT(entry != NULL && (entry->entrylo & TLBLO_VALID));
+    tlb_random(as_tlb_entryhi(as, faultaddress), entry->entrylo);
+    hpt_unlock(as, faultaddress);
 
+    frame_unpin(frame);
+    vm_faultaround(as, found_region, faultaddress);
     return 0;
 }
 
 /*
- * SMP-specific functions.  Unused in our UNSW configuration.
+ * SMP-specific functions.
  */
 
+/*
+    Handles a TLB shootdown from another CPU. Shootdowns are sent by the
+    address space code, which tracks the CPUs an address space has TLB
+    entries on (see as_tlb_invalidate()).
+*/
 void vm_tlbshootdown(const struct tlbshootdown *ts)
 {
-    (void)ts;
-    kfree(hpt);
-    panic("vm tried to do tlb shootdown?!\n");
+    as_tlbshootdown(ts);
 }
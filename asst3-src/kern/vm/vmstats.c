@@ -0,0 +1,58 @@
+#include <types.h>
+#include <lib.h>
+#include <vm.h>
+#include <vmstats.h>
+#include "opt-unsw.h"
+
+/* Each CPU's counters, indexed by cpu number */
+struct vmstats vmstats_cpu[MAXCPUS];
+
+#define VMSTATS_NFIELDS (sizeof(struct vmstats) / sizeof(uint32_t))
+
+/*
+    Adds up the counters of every CPU. The frame counts are a snapshot
+    taken from the frame allocator rather than a count of events.
+*/
+void vmstats_get(struct vmstats *vs)
+{
+    uint32_t *total = (uint32_t *)vs;
+
+    bzero(vs, sizeof(*vs));
+    for (unsigned i = 0; i < MAXCPUS; i++)
+    {
+        // plain reads; another CPU may be counting meanwhile
+        const uint32_t *counts = (const uint32_t *)&vmstats_cpu[i];
+        for (unsigned j = 0; j < VMSTATS_NFIELDS; j++)
+            total[j] += counts[j];
+    }
+    vs->vs_frames = 0;
+    vs->vs_framesfree = 0;
+
+#if OPT_UNSW
+    frame_usage(vs);
+#endif
+}
+
+void vmstats_print(void)
+{
+    struct vmstats vs;
+
+    vmstats_get(&vs);
+
+    kprintf("vm: %u faults: %u refills, %u first touches, %u TLB entries preloaded\n",
+            vs.vs_faults, vs.vs_refills, vs.vs_firsttouch, vs.vs_faultaround);
+    kprintf("vm: %u pages zero-filled (%u from the zero pool)\n",
+            vs.vs_zerofills, vs.vs_zeropool);
+    kprintf("vm: %u pages shared at fork, %u copied on write\n",
+            vs.vs_forkshared, vs.vs_cowcopies);
+    kprintf("vm: %u pages swapped in, %u swapped out\n",
+            vs.vs_swapins, vs.vs_swapouts);
+    kprintf("vm: %u TLB flushes, %u shootdowns sent\n",
+            vs.vs_tlbflushes, vs.vs_shootdowns);
+    kprintf("vm: %u page table lookups, %u.%02u entries visited on average\n",
+            vs.vs_ptlookups,
+            vs.vs_ptlookups ? vs.vs_ptprobes / vs.vs_ptlookups : 0,
+            vs.vs_ptlookups ? (uint32_t)((uint64_t)vs.vs_ptprobes * 100 / vs.vs_ptlookups % 100) : 0);
+    kprintf("vm: %u frames allocated, %u freed; %u of %u frames free\n",
+            vs.vs_framealloc, vs.vs_framefree, vs.vs_framesfree, vs.vs_frames);
+}
@@ -0,0 +1,128 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <vm.h>
+#include <swap.h>
+#include <zeropool.h>
+
+/* Zeroed frames, ready to be handed out */
+static vaddr_t zeropool[ZEROPOOL_SIZE];
+static unsigned zeropool_count = 0;
+
+/* Counts of zeropool_get() calls that found a frame, and that did not */
+static unsigned zeropool_hits = 0;
+static unsigned zeropool_misses = 0;
+
+/*
+ * Protects the pool and counters. The zeroing thread sleeps on
+ * zeropool_wchan while the pool is full, or memory is.
+ */
+static struct spinlock zeropool_lock = SPINLOCK_INITIALIZER;
+static struct wchan *zeropool_wchan;
+
+/*
+    Keeps the pool topped up. The thread only zeroes a frame when no other
+    thread is waiting to run on its cpu, and yields to them otherwise, so it
+    only uses time that would be spent idle. It runs at the lowest priority,
+    where its sleeps and yields cannot raise it above real work. It does not
+    take frames from the kernel's reserve (see alloc_upage()).
+*/
+static void zeropool_thread(void *unused1, unsigned long unused2)
+{
+    (void)unused1;
+    (void)unused2;
+
+    thread_set_background();
+
+    while (1)
+    {
+        spinlock_acquire(&zeropool_lock);
+        while (zeropool_count >= ZEROPOOL_SIZE)
+            wchan_sleep(zeropool_wchan, &zeropool_lock);
+        spinlock_release(&zeropool_lock);
+
+        if (thread_cpu_busy())
+        {
+            thread_yield();
+            continue;
+        }
+
+        vaddr_t frame = 0;
+        if (frame_free_count() > SWAP_RESERVE)
+            frame = alloc_kpages(1);
+        if (frame == 0)
+        {
+            // memory is full; wait for the next fault to try again
+            spinlock_acquire(&zeropool_lock);
+            wchan_sleep(zeropool_wchan, &zeropool_lock);
+            spinlock_release(&zeropool_lock);
+            continue;
+        }
+
+        bzero((void *)frame, PAGE_SIZE);
+
+        spinlock_acquire(&zeropool_lock);
+        KASSERT(zeropool_count < ZEROPOOL_SIZE);
+        zeropool[zeropool_count++] = frame;
+        spinlock_release(&zeropool_lock);
+    }
+}
+
+void zeropool_bootstrap(void)
+{
+    zeropool_wchan = wchan_create("zeropool");
+    if (zeropool_wchan == NULL)
+        panic("zeropool: cannot create wchan\n");
+
+    int result = thread_fork("zeropool", NULL, zeropool_thread, NULL, 0);
+    if (result)
+        panic("zeropool: cannot start thread: %s\n", strerror(result));
+}
+
+vaddr_t zeropool_get(void)
+{
+    vaddr_t frame = 0;
+
+    spinlock_acquire(&zeropool_lock);
+    if (zeropool_count > 0)
+    {
+        frame = zeropool[--zeropool_count];
+        zeropool_hits++;
+    }
+    else
+    {
+        zeropool_misses++;
+    }
+    if (zeropool_count < ZEROPOOL_LOW)
+        wchan_wakeone(zeropool_wchan, &zeropool_lock);
+    spinlock_release(&zeropool_lock);
+
+    return frame;
+}
+
+vaddr_t zeropool_reclaim(void)
+{
+    vaddr_t frame = 0;
+
+    spinlock_acquire(&zeropool_lock);
+    if (zeropool_count > 0)
+        frame = zeropool[--zeropool_count];
+    spinlock_release(&zeropool_lock);
+
+    return frame;
+}
+
+void zeropool_printstats(void)
+{
+    spinlock_acquire(&zeropool_lock);
+    unsigned count = zeropool_count;
+    unsigned hits = zeropool_hits;
+    unsigned misses = zeropool_misses;
+    spinlock_release(&zeropool_lock);
+
+    kprintf("zeropool: %u of %u frames ready, %u hits, %u misses\n",
+            count, ZEROPOOL_SIZE, hits, misses);
+}
@@ -421,11 +421,16 @@ docommand(char *buf, struct exitinfo *ei)
 		__time(&startsecs, &startnsecs);
 	}
 
-	pid = fork();
+	/*
+	 * The child only execs, so use vfork() to save copying our
+	 * address space. It runs in our memory until the exec, which
+	 * is fine as long as it does nothing but exec or _exit.
+	 */
+	pid = vfork();
 	switch (pid) {
 		case -1:
 			/* error */
-			warn("fork");
+			warn("vfork");
 			exitinfo_exit(ei, 255);
 			return;
 		case 0:
@@ -40,9 +40,11 @@
  */
 #include <kern/fcntl.h>
 #include <kern/ioctl.h>
+#include <kern/mman.h>
 #include <kern/reboot.h>
 #include <kern/seek.h>
 #include <kern/time.h>
+#include <kern/vmstats.h>
 #include <kern/unistd.h>
 #include <kern/wait.h>
 
@@ -112,6 +114,7 @@
 __DEAD void _exit(int code);
 int execv(const char *prog, char *const *args);
 pid_t fork(void);
+pid_t vfork(void);
 pid_t waitpid(pid_t pid, int *returncode, int flags);
 /*
  * Open actually takes either two or three args: the optional third
@@ -159,15 +162,19 @@ int execvp(const char *prog, char *const *args); /* calls execv */
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
 time_t time(time_t *seconds);			/* calls __time */
 
-/* UNSW versions of mmap() and munmap()
+/* UNSW versions of mmap(), munmap() and msync()
  * This are simplified compared to the standard version on UNIX
  * You should implement this version as this is what we expect to test.
  */
 
-#define PROT_READ 1
-#define PROT_WRITE 2
+/* PROT_* and MAP_* flags are in <kern/mman.h> */
+#define MAP_FAILED ((void *)-1)		/* returned by mmap() on error */
 
 void *mmap(size_t length, int prot, int fd, off_t offset);
 int munmap(void *addr);
+int msync(void *addr);
+
+/* UNSW addition: the kernel's VM counters, see <kern/vmstats.h> */
+int vmstat(struct vmstats *vs);
 
 #endif /* _UNISTD_H_ */
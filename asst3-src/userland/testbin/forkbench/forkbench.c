@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * forkbench - time fork/exit/wait cycles: the parent forks a child
+ * that exits at once, and waits for it, over and over. Prints the
+ * average time a cycle takes, which is mostly the kernel's cost of
+ * creating and tearing down a process.
+ *
+ * An optional argument gives the number of cycles.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+
+#define DEFAULT_CYCLES 200
+
+int
+main(int argc, char *argv[])
+{
+	unsigned cycles, i;
+	time_t startsecs, endsecs;
+	unsigned long startnsecs, endnsecs;
+	unsigned long long ns;
+	pid_t pid;
+	int status;
+
+	cycles = DEFAULT_CYCLES;
+	if (argc == 2) {
+		cycles = atoi(argv[1]);
+	}
+	else if (argc > 2) {
+		errx(1, "Usage: forkbench [cycles]");
+	}
+	if (cycles == 0) {
+		errx(1, "forkbench: need at least one cycle");
+	}
+
+	__time(&startsecs, &startnsecs);
+	for (i=0; i<cycles; i++) {
+		pid = fork();
+		if (pid < 0) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			_exit(0);
+		}
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			errx(1, "child %d did not exit cleanly", pid);
+		}
+	}
+	__time(&endsecs, &endnsecs);
+
+	ns = (unsigned long long)(endsecs - startsecs) * 1000000000ULL;
+	ns += endnsecs;
+	ns -= startnsecs;
+
+	printf("forkbench: %u cycles, %llu us per fork/exit/wait\n",
+	       cycles, ns / cycles / 1000);
+	return 0;
+}
@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * mmaptest - check file mappings.
+ *
+ * Writes a file, maps it shared and private, and checks that changes
+ * to the shared mapping reach the file (after msync and after munmap)
+ * while changes to the private one do not. Then checks that anonymous
+ * shared memory is shared with a child process and private anonymous
+ * memory is not.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+#define FILENAME "mmaptest.dat"
+#define NPAGES 8
+#define PAGESIZE 4096
+#define FILESIZE (NPAGES * PAGESIZE)
+
+static char buf[PAGESIZE];
+
+static
+char
+pattern(unsigned pos, unsigned pass)
+{
+	return (char)('a' + (pos / PAGESIZE + pos + pass) % 26);
+}
+
+/* Check the file contents with read(). */
+static
+void
+checkfile(int fd, unsigned pass)
+{
+	unsigned i, j;
+	int r;
+
+	if (lseek(fd, 0, SEEK_SET) == -1) {
+		err(1, "%s: lseek", FILENAME);
+	}
+	for (i=0; i<NPAGES; i++) {
+		r = read(fd, buf, PAGESIZE);
+		if (r < 0) {
+			err(1, "%s: read", FILENAME);
+		}
+		if (r != PAGESIZE) {
+			errx(1, "%s: short read", FILENAME);
+		}
+		for (j=0; j<PAGESIZE; j++) {
+			if (buf[j] != pattern(i * PAGESIZE + j, pass)) {
+				errx(1, "%s: byte %u is wrong after pass %u",
+				     FILENAME, i * PAGESIZE + j, pass);
+			}
+		}
+	}
+}
+
+/* Check the contents of a mapping. */
+static
+void
+checkmap(const char *map, unsigned pass, const char *what)
+{
+	unsigned i;
+
+	for (i=0; i<FILESIZE; i++) {
+		if (map[i] != pattern(i, pass)) {
+			errx(1, "%s mapping: byte %u is wrong after pass %u",
+			     what, i, pass);
+		}
+	}
+}
+
+static
+void
+fillmap(char *map, unsigned pass)
+{
+	unsigned i;
+
+	for (i=0; i<FILESIZE; i++) {
+		map[i] = pattern(i, pass);
+	}
+}
+
+/*
+ * Fork a child that overwrites both an anonymous shared and an
+ * anonymous private mapping, and check that only the shared one
+ * changes in the parent.
+ */
+static
+void
+anontest(void)
+{
+	char *shared, *priv;
+	pid_t pid;
+	int status;
+
+	shared = mmap(FILESIZE, PROT_READ|PROT_WRITE|MAP_SHARED|MAP_ANON,
+		      -1, 0);
+	if (shared == MAP_FAILED) {
+		err(1, "mmap anonymous shared");
+	}
+	priv = mmap(FILESIZE, PROT_READ|PROT_WRITE|MAP_PRIVATE|MAP_ANON,
+		    -1, 0);
+	if (priv == MAP_FAILED) {
+		err(1, "mmap anonymous private");
+	}
+
+	/* only touch half of the pages, so some are shared untouched */
+	memset(shared, 0, FILESIZE / 2);
+	fillmap(priv, 4);
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		fillmap(shared, 5);
+		fillmap(priv, 6);
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "child failed");
+	}
+
+	checkmap(shared, 5, "anonymous shared");
+	checkmap(priv, 4, "anonymous private");
+
+	if (munmap(shared) || munmap(priv)) {
+		err(1, "munmap anonymous");
+	}
+}
+
+int
+main(void)
+{
+	char *map, *priv;
+	unsigned i, j;
+	int fd, r;
+
+	fd = open(FILENAME, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s: create", FILENAME);
+	}
+	for (i=0; i<NPAGES; i++) {
+		for (j=0; j<PAGESIZE; j++) {
+			buf[j] = pattern(i * PAGESIZE + j, 0);
+		}
+		r = write(fd, buf, PAGESIZE);
+		if (r != PAGESIZE) {
+			err(1, "%s: write", FILENAME);
+		}
+	}
+
+	printf("Mapping the file shared...\n");
+	map = mmap(FILESIZE, PROT_READ|PROT_WRITE|MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		err(1, "mmap shared");
+	}
+	checkmap(map, 0, "shared");
+
+	fillmap(map, 1);
+	if (msync(map)) {
+		err(1, "msync");
+	}
+	checkfile(fd, 1);
+
+	printf("Mapping the file private...\n");
+	priv = mmap(FILESIZE, PROT_READ|PROT_WRITE|MAP_PRIVATE, fd, 0);
+	if (priv == MAP_FAILED) {
+		err(1, "mmap private");
+	}
+	checkmap(priv, 1, "private");
+	fillmap(priv, 2);
+	checkmap(priv, 2, "private");
+	if (munmap(priv)) {
+		err(1, "munmap private");
+	}
+	checkfile(fd, 1);
+
+	printf("Unmapping the shared mapping...\n");
+	fillmap(map, 3);
+	if (munmap(map)) {
+		err(1, "munmap shared");
+	}
+	checkfile(fd, 3);
+
+	if (munmap(map) == 0) {
+		errx(1, "munmap of an unmapped address succeeded");
+	}
+
+	close(fd);
+	remove(FILENAME);
+
+	printf("Sharing anonymous memory with a child...\n");
+	anontest();
+
+	printf("mmaptest: passed\n");
+	return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * stacktest - recurse deep enough to need far more stack than a
+ * process starts out with, and check every frame on the way back up.
+ * The stack should grow on demand.
+ *
+ * An optional argument gives the depth; each level uses a little over
+ * 1k of stack.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+
+#define DEFAULT_DEPTH 1024	/* about 1M of stack */
+#define FRAMEWORDS 256
+
+static
+unsigned
+recurse(unsigned depth)
+{
+	volatile unsigned frame[FRAMEWORDS];
+	unsigned i, sum;
+
+	for (i=0; i<FRAMEWORDS; i++) {
+		frame[i] = depth * FRAMEWORDS + i;
+	}
+
+	sum = depth > 0 ? recurse(depth - 1) : 0;
+
+	for (i=0; i<FRAMEWORDS; i++) {
+		if (frame[i] != depth * FRAMEWORDS + i) {
+			errx(1, "frame at depth %u was overwritten", depth);
+		}
+	}
+	return sum + 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned depth, levels;
+
+	depth = DEFAULT_DEPTH;
+	if (argc == 2) {
+		depth = atoi(argv[1]);
+	}
+	else if (argc > 2) {
+		errx(1, "Usage: stacktest [depth]");
+	}
+
+	printf("Recursing %u levels...\n", depth);
+	levels = recurse(depth);
+	if (levels != depth + 1) {
+		errx(1, "returned from %u levels, expected %u",
+		     levels, depth + 1);
+	}
+
+	printf("stacktest: passed\n");
+	return 0;
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * vmstat - print the kernel's VM counters. Given a program to run,
+ * runs it and prints how much each counter moved while it did, so a
+ * benchmark can be measured without changing it:
+ *
+ *	/testbin/vmstat /testbin/matmult
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <err.h>
+
+#define NCOUNTERS (sizeof(struct vmstats) / sizeof(__u32))
+
+/* Same order as struct vmstats */
+static const char *const names[NCOUNTERS] = {
+	"faults", "TLB refills", "first touches", "fault-around loads",
+	"zero-fills", "zero pool hits",
+	"pages shared at fork", "copy-on-write copies",
+	"swap-ins", "swap-outs",
+	"TLB flushes", "TLB shootdowns",
+	"page table lookups", "page table probes",
+	"frames allocated", "frames freed",
+	"frames", "frames free",
+};
+
+static
+void
+getstats(struct vmstats *vs)
+{
+	if (vmstat(vs) < 0) {
+		err(1, "vmstat");
+	}
+}
+
+static
+void
+printstats(const struct vmstats *vs, const struct vmstats *before)
+{
+	const __u32 *now = (const __u32 *)vs;
+	const __u32 *then = (const __u32 *)before;
+	unsigned i;
+
+	for (i=0; i<NCOUNTERS; i++) {
+		if (before == NULL || &now[i] >= (const __u32 *)&vs->vs_frames) {
+			/* totals; the frame counts are a snapshot anyway */
+			printf("%24s: %u\n", names[i], now[i]);
+		}
+		else {
+			printf("%24s: %u\n", names[i], now[i] - then[i]);
+		}
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct vmstats before, after;
+	pid_t pid;
+	int status;
+
+	if (argc == 1) {
+		getstats(&after);
+		printstats(&after, NULL);
+		return 0;
+	}
+
+	getstats(&before);
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		execv(argv[1], argv + 1);
+		err(1, "%s", argv[1]);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+
+	getstats(&after);
+
+	if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+		warnx("%s exited with status %d", argv[1],
+		      WEXITSTATUS(status));
+	}
+	else if (WIFSIGNALED(status)) {
+		warnx("%s: signal %d", argv[1], WTERMSIG(status));
+	}
+	printf("VM counters for %s (including its fork and exec):\n",
+	       argv[1]);
+	printstats(&after, &before);
+	return 0;
+}